@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rope.h"
+#include "terminal.h"
+
+
+/*
+-> Compares the iterative split(), concat() and free_rope() with the recursive versions they replaced
+-> The recursive versions are kept here as they were (adapted to reference counted nodes, see rope.h)
+-> They only handle ropes whose nodes aren't shared -> the benchmark never retains a rope
+-> Usage: rope_bench [size in MB] [rounds]
+*/
+
+
+#define DEFAULT_SIZE_MB 64
+#define DEFAULT_ROUNDS 200000
+
+
+// Returns the time elapsed since 'start' in nanoseconds
+static double elapsed_ns(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+
+// Creates an internal node over two subtrees (same as create_internal() in rope_core.c)
+static RopeNode *make_internal(RopeNode *left_subtree, RopeNode *right_subtree) {
+	RopeNode *node = pool_alloc(sizeof(RopeNode));
+
+	node->left = left_subtree;
+	node->right = right_subtree;
+	node->refs = 1;
+
+	update_metadata(node);
+	return node;
+}
+
+
+// Returns a node to the memory pool (same as release_node() in rope_core.c)
+static void release(RopeNode *node) {
+	drop_line_offsets(node);
+
+	if (node->str != NULL && !is_borrowed(node))
+		pool_free(node, LEAF_NODE_SIZE);
+	else
+		pool_free(node, sizeof(RopeNode));
+}
+
+
+// Recursive concat(): recurses down the spine of the taller subtree and rebalances on return
+static RopeNode *concat_recursive(RopeNode *left_subtree, RopeNode *right_subtree) {
+	if (left_subtree == NULL)
+		return right_subtree;
+	if (right_subtree == NULL)
+		return left_subtree;
+
+	RopeNode *concatenated_root;
+	int skew = node_height(right_subtree) - node_height(left_subtree);
+
+	// CASE-1: There isn't much height difference between left_subtree and right_subtree
+	if (skew >= -1 && skew <= 1)
+		return make_internal(left_subtree, right_subtree);
+
+	// CASE-2: Right subtree is heavier -> attach left_subtree deep in the left spine of right_subtree
+	else if (skew >= 2) {
+		right_subtree->left = concat_recursive(left_subtree, right_subtree->left);
+		concatenated_root = right_subtree;
+	}
+
+	// CASE-3: Left subtree is heavier -> attach right_subtree deep in the right spine of left_subtree
+	else {
+		left_subtree->right = concat_recursive(left_subtree->right, right_subtree);
+		concatenated_root = left_subtree;
+	}
+
+	update_metadata(concatenated_root);
+	return rebalance(concatenated_root);
+}
+
+
+// Recursive split(): splits the child holding 'idx' and joins the other child to its half on return
+static void split_recursive(RopeNode *node, int idx, RopeNode **left, RopeNode **right) {
+	*left = NULL;
+	*right = NULL;
+	if (node == NULL)
+		return;
+
+	// BASE CASE
+	if (is_leaf(node)) {
+		int len = node->weight;
+
+		if (idx <= 0) {
+			*right = node;
+		}
+		else if (idx >= len) {
+			*left = node;
+		}
+		else {
+			*left = create_leaf(node->str, idx);
+			*right = create_leaf(node->str + idx, len - idx);
+			release(node);
+		}
+
+		return;
+	}
+
+	RopeNode *left_split, *right_split;
+
+	// CASE-1: required index is in the left subtree
+	if (idx < node->weight) {
+		split_recursive(node->left, idx, &left_split, &right_split);
+		*left = left_split;
+		*right = concat_recursive(right_split, node->right);
+	}
+
+	// CASE-2: required index is in the right subtree
+	else {
+		split_recursive(node->right, idx - node->weight, &left_split, &right_split);
+		*left = concat_recursive(node->left, left_split);
+		*right = right_split;
+	}
+
+	release(node);
+}
+
+
+// Recursive free_rope(): post order
+static void free_recursive(RopeNode *node) {
+	if (node == NULL)
+		return;
+
+	free_recursive(node->left);
+	free_recursive(node->right);
+	release(node);
+}
+
+
+// Builds a rope of 'len' bytes of text made of short lines
+static RopeNode *make_rope(int len) {
+	char *text = malloc(len);
+	if (text == NULL)
+		halt("make_rope");
+
+	for (int i = 0; i < len; i++)
+		text[i] = (i % 64 == 63) ? '\n' : 'a' + i % 26;
+
+	RopeNode *root = build_rope(text, len);
+	free(text);
+
+	return root;
+}
+
+
+/*
+-> Splits the rope at 'rounds' pseudo-random indices and concatenates the halves back
+-> Returns the average time of a split + concat in nanoseconds
+*/
+static double bench_split_concat(RopeNode **root, int rounds, bool recursive) {
+	int len = (*root)->total_len;
+	unsigned seed = 1;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (int i = 0; i < rounds; i++) {
+		seed = seed * 1103515245 + 12345;
+		int idx = (seed >> 1) % len;
+
+		RopeNode *left, *right;
+		if (recursive) {
+			split_recursive(*root, idx, &left, &right);
+			*root = concat_recursive(left, right);
+		}
+		else {
+			split(*root, idx, &left, &right);
+			*root = concat(left, right);
+		}
+	}
+
+	return elapsed_ns(&start) / rounds;
+}
+
+
+// Frees the rope and returns the time it took in milliseconds
+static double bench_free(RopeNode *root, bool recursive) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (recursive)
+		free_recursive(root);
+	else
+		free_rope(root);
+
+	return elapsed_ns(&start) / 1e6;
+}
+
+
+int main(int argc, char **argv) {
+	int size_mb = (argc > 1) ? atoi(argv[1]) : DEFAULT_SIZE_MB;
+	int rounds = (argc > 2) ? atoi(argv[2]) : DEFAULT_ROUNDS;
+	if (size_mb <= 0 || size_mb > 1024 || rounds <= 0) {
+		fprintf(stderr, "Usage: %s [size in MB (1-1024)] [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	int len = size_mb * 1024 * 1024;
+	RopeNode *recursive = make_rope(len);
+	RopeNode *iterative = make_rope(len);
+	printf("rope: %d MB, height %d, %d rounds\n\n", size_mb, node_height(iterative), rounds);
+
+	double split_rec = bench_split_concat(&recursive, rounds, true);
+	double split_it = bench_split_concat(&iterative, rounds, false);
+	if (recursive->total_len != len || iterative->total_len != len) {
+		fprintf(stderr, "rope length changed\n");
+		return 1;
+	}
+
+	double free_rec = bench_free(recursive, true);
+	double free_it = bench_free(iterative, false);
+
+	printf("%-16s %14s %14s\n", "", "recursive", "iterative");
+	printf("%-16s %11.0f ns %11.0f ns\n", "split + concat", split_rec, split_it);
+	printf("%-16s %11.1f ms %11.1f ms\n", "free_rope", free_rec, free_it);
+
+	pool_destroy();
+	return 0;
+}
@@ -0,0 +1,135 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "file_io.h"
+#include "rope.h"
+#include "terminal.h"
+
+
+/*
+-> Compares write_rope_to_fd() (spans batched into writev()) with the stdio path it replaced (one fwrite() per span)
+-> Both write the same rope (regular CHUNK_SIZE leaves, as built for typed or read text) to a file without fsync()
+-> Usage: save_bench [size in MB] [output file]
+*/
+
+
+#define DEFAULT_SIZE_MB 1024
+#define DEFAULT_OUTPUT "save_bench.out"
+
+
+// Returns the time elapsed since 'start' in milliseconds
+static double elapsed_ms(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+
+// Previous save path: the spans of the rope go through stdio's buffer
+static bool write_rope_stdio(RopeNode *root, const char *filename) {
+	FILE *fp = fopen(filename, "wb");
+	if (fp == NULL)
+		return false;
+
+	RopeIter it;
+	if (rope_iter_init(&it, root, 0)) {
+		const char *span;
+		int len;
+		while ((len = rope_iter_next(&it, &span)) > 0)
+			fwrite(span, 1, len, fp);
+	}
+
+	bool ok = !ferror(fp);
+	if (fclose(fp) == EOF)
+		ok = false;
+
+	return ok;
+}
+
+
+// Current save path
+static bool write_rope_writev(RopeNode *root, const char *filename) {
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		return false;
+
+	bool ok = write_rope_to_fd(root, fd, false);
+	if (close(fd) == -1)
+		ok = false;
+
+	return ok;
+}
+
+
+// Builds a rope of 'len' bytes of text made of short lines
+static RopeNode *make_rope(size_t len) {
+	char *text = malloc(len);
+	if (text == NULL)
+		halt("make_rope");
+
+	for (size_t i = 0; i < len; i++)
+		text[i] = (i % 64 == 63) ? '\n' : 'a' + i % 26;
+
+	RopeNode *root = build_rope(text, len);
+	free(text);
+
+	return root;
+}
+
+
+// Writes the rope with one of the paths and returns the time it took in milliseconds (-1 on failure or short file)
+static double bench_save(RopeNode *root, const char *filename, bool stdio) {
+	unlink(filename);  // both paths start from a missing file
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	bool ok = stdio ? write_rope_stdio(root, filename) : write_rope_writev(root, filename);
+	double ms = elapsed_ms(&start);
+
+	struct stat st;
+	if (!ok || stat(filename, &st) == -1 || st.st_size != root->total_len)
+		return -1;
+
+	return ms;
+}
+
+
+int main(int argc, char **argv) {
+	int size_mb = (argc > 1) ? atoi(argv[1]) : DEFAULT_SIZE_MB;
+	const char *filename = (argc > 2) ? argv[2] : DEFAULT_OUTPUT;
+	if (size_mb <= 0 || size_mb > 2047) {
+		fprintf(stderr, "Usage: %s [size in MB (1-2047)] [output file]\n", argv[0]);
+		return 1;
+	}
+
+	RopeNode *root = make_rope((size_t)size_mb * 1024 * 1024);
+	printf("rope: %d MB in %d byte leaves, writing to %s\n\n", size_mb, CHUNK_SIZE, filename);
+
+	// Each path runs twice: the first run of either one also pays for allocating the file's pages in the page cache
+	double times[2][2];
+	for (int run = 0; run < 2; run++) {
+		for (int stdio = 0; stdio < 2; stdio++) {
+			times[stdio][run] = bench_save(root, filename, stdio);
+			if (times[stdio][run] < 0) {
+				perror(filename);
+				return 1;
+			}
+		}
+	}
+	unlink(filename);
+
+	printf("%-8s %12s %12s %12s\n", "", "run 1", "run 2", "MB/s");
+	printf("%-8s %9.1f ms %9.1f ms %12.0f\n", "stdio", times[1][0], times[1][1], size_mb / (times[1][1] / 1e3));
+	printf("%-8s %9.1f ms %9.1f ms %12.0f\n", "writev", times[0][0], times[0][1], size_mb / (times[0][1] / 1e3));
+
+	free_rope(root);
+	pool_destroy();
+	return 0;
+}
@@ -9,8 +9,21 @@
 #include "rope.h"
 
 # define ABUF_INIT {NULL, 0, 0}
+# define ABUF_MIN_CAPACITY 64  // smallest allocation made by ab_append()
 # define CTRL_PLUS(ch) ((ch) & 0x1f)  // 'Ctrl + <ch>'
 # define TAB_WIDTH 4
+# define STATUS_MSG_TIMEOUT 5  // seconds a status message stays visible
+# define INSERT_SESSION_SIZE 4096  // typed characters buffered before they are committed to the rope
+# define UNDO_LEVELS 10000  // changes kept in the undo history (the oldest one is dropped beyond this)
+
+// Undo settings which can be chosen by the build (see TIM_UNDO_BACKEND and TIM_UNDO_LOG_BUDGET in src/editor/CMakeLists.txt)
+# ifndef UNDO_BACKEND
+# define UNDO_BACKEND UNDO_SNAPSHOTS  // how the undo history is kept (see UndoBackend)
+# endif
+# ifndef UNDO_LOG_BUDGET
+# define UNDO_LOG_BUDGET (16 * 1024 * 1024)  // bytes the operation log may hold before its oldest changes are dropped
+# endif
+# define UNDO_GROUP_BUDGET (UNDO_LOG_BUDGET / 8)  // bytes a group may hold before a long change continues in a new group
 
 
 // Modes of the editor
@@ -20,6 +33,120 @@ typedef enum EditorMode {
     MODE_COMMAND
 } EditorMode;
 
+/*
+-> Cached mapping of the cursor line to the rope
+-> Saves a tree descent + leaf scan per keystroke: motions and edits update it incrementally
+-> 'iter' is only valid until the next rope edit (edits drop it)
+*/
+typedef struct CursorCache {
+    int line;        // line the cache belongs to (-1 if the cache is invalid)
+    int line_start;  // rope index of the first character of 'line'
+    int line_len;    // length of 'line' excluding the newline (-1 if unknown)
+    RopeIter iter;   // most recently visited leaf around the cursor (iter.leaf = NULL if unknown)
+} CursorCache;
+
+/*
+-> Characters typed in insert mode which haven't been committed to the rope yet
+-> The session covers a gap [anchor - erased, anchor) of the cursor line which is replaced by 'pending'
+-> It is committed with one delete_at() + one insert_at() on Esc, on cursor motion, on Enter or when 'pending' is full
+-> Until then the cursor line is rendered with the gap replaced by 'pending' (overlay)
+*/
+typedef struct InsertSession {
+    bool active;                          // 'true' while there is an uncommitted session
+    int line;                             // line being edited (always the cursor line)
+    int anchor;                           // rope index where the session started
+    int erased;                           // rope characters right before 'anchor' removed by backspace
+    int pending_len;                      // number of characters in 'pending'
+    char pending[INSERT_SESSION_SIZE];    // typed characters
+} InsertSession;
+
+// Ways to keep the undo history
+typedef enum UndoBackend {
+    UNDO_SNAPSHOTS,  // persistent rope versions: O(1) undo/redo, O(log n) nodes per change (see editor_undo.c)
+    UNDO_OPLOG       // log of the replaced text: only changed text is kept, within UNDO_LOG_BUDGET (see editor_oplog.c)
+} UndoBackend;
+
+// A version of the text kept in the undo history
+typedef struct UndoRevision {
+    RopeNode *rope;            // root of the version (the history holds a reference to it)
+    int before_cx, before_cy;  // cursor right before the change which produced this version
+    int after_cx, after_cy;    // cursor right after that change
+} UndoRevision;
+
+// An edit recorded by the operation log: 'removed' text at 'offset' was replaced by 'inserted' text
+typedef struct UndoOp {
+    int offset;        // rope index of the edit
+    int removed_len;   // length of the removed text
+    int inserted_len;  // length of the inserted text
+    char *text;        // removed text followed by inserted text
+} UndoOp;
+
+// Edits of one change (e.g. a whole insert mode session) which are undone and redone together
+typedef struct UndoGroup {
+    int first;                 // index of the group's first edit in the log
+    int count;                 // number of edits in the group
+    int before_cx, before_cy;  // cursor right before the change
+    int after_cx, after_cy;    // cursor right after the change
+    size_t bytes;              // memory held by the group's edits (kept within UNDO_GROUP_BUDGET)
+} UndoGroup;
+
+/*
+-> Operation log of the UNDO_OPLOG backend: edits in the order they were made, split into groups
+-> Adjacent edits of a group are merged into one (typing a word is one edit, not one per character)
+*/
+typedef struct UndoLog {
+    UndoOp *ops;
+    int op_count;
+    int op_capacity;
+    UndoGroup *groups;
+    int group_count;
+    int group_capacity;
+    int current;   // number of groups applied to the text (the ones after it can be redone)
+    bool open;     // 'true' while the last group still collects edits
+    size_t bytes;  // memory held by the edits (kept within UNDO_LOG_BUDGET)
+} UndoLog;
+
+/*
+-> Undo history kept by one of the backends (see UndoBackend)
+-> UNDO_SNAPSHOTS keeps every version of the text since the file was loaded, oldest first (one revision per change)
+-> Versions are persistent ropes which share all unchanged nodes -> undo and redo swap the editor's rope for another root
+-> UNDO_OPLOG keeps the edits which lead from one version to the next instead (see UndoLog)
+*/
+typedef struct UndoHistory {
+    UndoBackend backend;      // how the history is kept (UNDO_BACKEND)
+    UndoLog log;              // edits (UNDO_OPLOG only)
+    UndoRevision *revisions;  // versions (UNDO_SNAPSHOTS only)
+    int count;                // number of revisions in 'revisions'
+    int capacity;             // number of revisions 'revisions' has room for
+    int current;              // revision shown in the editor (the ones after it can be redone)
+    int start_cx, start_cy;   // cursor right before the change which hasn't been recorded yet
+} UndoHistory;
+
+// A dynamic string type which supports appending
+typedef struct AppendBuffer {
+    char *buffer;  // buffer for the string (doesn't include null terminator)
+    int bufflen;   // number of items occupied in the buffer
+    int capacity;  // max capacity of the buffer
+} AppendBuffer;
+
+// A screen row as it was last sent to the terminal
+typedef struct FrameLine {
+    AppendBuffer text;  // rendered row (including escape sequences)
+    bool valid;         // 'false' if the terminal's copy of the row is unknown
+} FrameLine;
+
+/*
+-> Screen contents as they were last written to the terminal: text rows, then the status bar and the message bar
+-> refresh_screen() only sends rows whose rendering differs from the frame (damage tracking)
+*/
+typedef struct Frame {
+    FrameLine *lines;  // one entry per screen row
+    int rows;          // number of entries in 'lines'
+    int rowoff;        // row offset the text rows were rendered with (-1 if unknown)
+    AppendBuffer out;  // output of the frame being drawn (cleared, never freed, between frames)
+    AppendBuffer row;  // rendering of the row being drawn (reused for every row)
+} Frame;
+
 // Maintains the editor’s runtime data and configuration
 typedef struct EditorState {
     int cx, cy;                 // cursor coordinate (0-indexed) -> location of cursor in the file
@@ -35,20 +162,18 @@ typedef struct EditorState {
     time_t statusmsg_time;      // timestamp of status message
     bool is_dirty;              // 'true' if the file has unsaved changes
     bool is_insert_mode_dirty;  // 'true' if insert mode made changes
+    bool save_queued;           // 'true' if a save was requested while another one was running
 
     EditorMode mode;            // current mode of the editor
 
     RopeNode *rope;             // data structure containing the text buffer
-    int numlines;               // number of lines in the rope
+    int numlines;               // number of lines in the rope (-1 until the lines of a memory-mapped file are counted)
+    CursorCache cursor;         // cursor line -> rope mapping (see CursorCache)
+    InsertSession session;      // uncommitted insert mode edits (see InsertSession)
+    Frame frame;                // what the terminal currently shows (see Frame)
+    UndoHistory undo;           // earlier and later versions of the text (see UndoHistory)
 } EditorState;
 
-// A dynamic string type which supports appending
-typedef struct AppendBuffer {
-    char *buffer;  // buffer for the string (doesn't include null terminator)
-    int bufflen;   // number of items occupied in the buffer
-    int capacity;  // max capacity of the buffer
-} AppendBuffer;
-
 
 // Global editor state
 extern EditorState E;
@@ -57,6 +182,7 @@ extern EditorState E;
 // Input operations
 void move_cursor(int key);
 int process_keypress(void);
+int handle_keypress(int ch);
 int handle_normal_keypress(int ch);  // TODO: return 'void' after moving exit command to command mode
 void handle_insert_keypress(int ch);
 int handle_command_keypress(int ch);
@@ -64,30 +190,81 @@ int handle_command_keypress(int ch);
 // Output operations
 void refresh_screen(void);
 void draw_rows(AppendBuffer *ab);
-void draw_line(AppendBuffer *ab, int filerow);
+void draw_line(AppendBuffer *ab, int filerow, int start);
 void scroll(void);
 void draw_status_bar(AppendBuffer *ab);
 void set_status_message(const char *fmt, ...);
 void draw_message_bar(AppendBuffer *ab);
+void expire_status_message(void);
 
 // Insert mode operations
 void insert_at_cursor(char ch);
 void insert_char_at_cursor(char ch);
 void insert_newline_at_cursor(void);
+void insert_text_at_cursor(const char *text, int len);
 void delete_char_before_cursor(void);
 bool delete_char_at_cursor(void);
 
+// Insert session operations
+void session_insert_char(char ch);
+bool session_backspace(void);
+void commit_insert_session(void);
+bool is_session_line(int line);
+
+// Undo operations
+void init_undo(void);
+void save_undo_cursor(void);
+void record_undo_revision(void);
+bool undo_change(void);
+bool redo_change(void);
+void restore_undo_cursor(int cx, int cy);
+void free_undo_history(void);
+
+// Operation log (UNDO_OPLOG backend)
+void init_undo_log(void);
+void log_edit(int idx, int removed_len, const char *inserted, int inserted_len);
+void close_undo_group(void);
+bool undo_logged_group(void);
+bool redo_logged_group(void);
+void free_undo_log(void);
+void insert_into_rope(int idx, const char *text, int len);
+void delete_from_rope(int idx, int len);
+
+// Save operations
+void save_buffer(void);
+void complete_save(void);
+
 // Append buffer operations
 void ab_append(AppendBuffer *ab, const char *str, int len);
+void ab_reserve(AppendBuffer *ab, int capacity);
+void ab_clear(AppendBuffer *ab);
 void ab_free(AppendBuffer *ab);
 
+// Frame operations
+void resize_frame(int rows);
+void invalidate_frame(void);
+void scroll_frame(AppendBuffer *ab);
+void free_frame(void);
+void update_frame_line(AppendBuffer *ab, int row, const AppendBuffer *content);
+
 // Editor initialization
 void init_editor(RopeNode *root, const char *filename);
+void resize_editor(void);
 
 // Helper functions
 int cx_to_rx(int line, int cx);
 int rx_to_cx(int line, int rx);
 int map_vim_nav_key(int ch);
 int get_rope_idx_from_cursor(void);
+int get_editor_line_start(int line);
+int get_cursor_line_start(void);
+int get_cursor_line_length(void);
+void set_cursor_line_start(int start);
+void invalidate_cursor_cache(void);
+void drop_cursor_leaf(void);
+char char_at(int idx);
+void add_numlines(int delta);
+bool is_last_line(void);
+int clamp_line(int line);
 
 #endif
@@ -8,38 +8,42 @@
 #include "rope.h"
 
 
+/*
+-> Grows the capacity of an AppendBuffer to at least 'capacity' bytes
+-> Capacity never shrinks -> a reused buffer stays at its high-water mark
+*/
+void ab_reserve(AppendBuffer *ab, int capacity) {
+    if (capacity <= ab->capacity)
+        return;
+
+    int cap = (ab->capacity > 0) ? ab->capacity : ABUF_MIN_CAPACITY;
+    while (cap < capacity)
+        cap *= 2;
+
+    char *new = realloc(ab->buffer, cap);
+    if (new == NULL)
+        halt("ab_reserve");
+
+    ab->buffer = new;
+    ab->capacity = cap;
+}
+
+
 // Append a string 'str' (of length 'len' excluding '\0') to an AppendBuffer
 void ab_append(AppendBuffer *ab, const char *str, int len) {
     if (str == NULL || len <= 0)
         return;
 
-    if (ab->buffer == NULL) {
-        ab->buffer = calloc(len, 1);
-        if (ab->buffer == NULL)
-            halt("ab_append");
-
-        memcpy(ab->buffer, str, len);
-
-        ab->capacity = len;
-        ab->bufflen = ab->capacity;
-    }
-
-    else {
-        int cap = ab->capacity;
-        while (cap < (ab->bufflen + len))
-            cap *= 2;
-        if (cap != ab->capacity) {
-            char *new = realloc(ab->buffer, cap);
-            if (new == NULL)
-                halt("ab_append");
-
-            ab->buffer = new;
-            ab->capacity = cap;
-        }
-
-        memcpy(&ab->buffer[ab->bufflen], str, len);
-        ab->bufflen += len;
-    }
+    ab_reserve(ab, ab->bufflen + len);
+
+    memcpy(&ab->buffer[ab->bufflen], str, len);
+    ab->bufflen += len;
+}
+
+
+// Empties an AppendBuffer but keeps its memory for reuse
+void ab_clear(AppendBuffer *ab) {
+    ab->bufflen = 0;
 }
 
 
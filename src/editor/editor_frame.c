@@ -0,0 +1,118 @@
+#include "editor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "terminal.h"
+
+
+/*
+-> Resizes the frame to 'rows' screen rows
+-> Every row becomes invalid -> the next refresh redraws the whole screen
+*/
+void resize_frame(int rows) {
+    for (int row = 0; row < E.frame.rows; row++)
+        ab_free(&E.frame.lines[row].text);
+    free(E.frame.lines);
+
+    E.frame.lines = calloc(rows, sizeof(FrameLine));
+    if (E.frame.lines == NULL)
+        halt("resize_frame");
+    E.frame.rows = rows;
+    E.frame.rowoff = -1;
+
+    // A full redraw is roughly a screenful of text plus escape sequences -> size the output buffer for it up front
+    ab_reserve(&E.frame.out, rows * (E.screencols + 16));
+    ab_reserve(&E.frame.row, E.screencols + 16);
+}
+
+
+// Forgets what the terminal shows (e.g. after a resize) -> the next refresh redraws the whole screen
+void invalidate_frame(void) {
+    for (int row = 0; row < E.frame.rows; row++)
+        E.frame.lines[row].valid = false;
+    E.frame.rowoff = -1;
+}
+
+
+// Frees the frame (including its output buffers)
+void free_frame(void) {
+    for (int row = 0; row < E.frame.rows; row++)
+        ab_free(&E.frame.lines[row].text);
+
+    free(E.frame.lines);
+    E.frame.lines = NULL;
+    E.frame.rows = 0;
+
+    ab_free(&E.frame.out);
+    ab_free(&E.frame.row);
+}
+
+
+/*
+-> Moves the text rows already on the terminal when the viewport scrolled vertically by less than a screen
+-> Uses a scroll region (DECSTBM) over the text rows so that the status/message bars stay in place
+-> The frame is shifted the same way -> only the rows which scrolled into view are redrawn afterwards
+*/
+void scroll_frame(AppendBuffer *ab) {
+    int delta = E.rowoff - E.frame.rowoff;  // > 0 -> content moves up
+    int textrows = E.screenrows;
+
+    if (E.frame.rowoff == -1 || delta == 0 || abs(delta) >= textrows) {
+        E.frame.rowoff = E.rowoff;
+        return;
+    }
+    E.frame.rowoff = E.rowoff;
+
+    // NOTE: "\x1b[T;Br" limits scrolling to rows T..B, "\x1b[NS"/"\x1b[NT" scroll the region up/down by N rows and "\x1b[r" resets the region
+    char seq[32];
+    int seqlen = snprintf(seq, sizeof(seq), "\x1b[1;%dr\x1b[%d%c\x1b[r", textrows, abs(delta), (delta > 0) ? 'S' : 'T');
+    ab_append(ab, seq, seqlen);
+
+    // Rotate the frame lines -> the rows which scrolled out are reused for the blank rows which scrolled in
+    int shift = abs(delta);
+    FrameLine *lines = E.frame.lines;
+    FrameLine exposed[shift];
+
+    if (delta > 0) {
+        memcpy(exposed, lines, shift * sizeof(FrameLine));
+        memmove(lines, lines + shift, (textrows - shift) * sizeof(FrameLine));
+        memcpy(lines + textrows - shift, exposed, shift * sizeof(FrameLine));
+    }
+    else {
+        memcpy(exposed, lines + textrows - shift, shift * sizeof(FrameLine));
+        memmove(lines + shift, lines, (textrows - shift) * sizeof(FrameLine));
+        memcpy(lines, exposed, shift * sizeof(FrameLine));
+    }
+
+    FrameLine *blank = (delta > 0) ? lines + textrows - shift : lines;
+    for (int i = 0; i < shift; i++) {
+        ab_clear(&blank[i].text);
+        blank[i].valid = true;  // the terminal scrolled in an empty row
+    }
+}
+
+
+/*
+-> Compares the new rendering 'content' of a screen row (0-indexed) with the frame
+-> If they differ, appends the output which redraws the row to 'ab' and records 'content' in the frame
+-> Nothing is appended for unchanged rows
+*/
+void update_frame_line(AppendBuffer *ab, int row, const AppendBuffer *content) {
+    FrameLine *line = &E.frame.lines[row];
+
+    if (line->valid && line->text.bufflen == content->bufflen &&
+            (content->bufflen == 0 || memcmp(line->text.buffer, content->buffer, content->bufflen) == 0))
+        return;
+
+    // NOTE: "\x1b[X;1H" moves cursor to the start of row X (1-indexed) and "\x1b[2K" clears it
+    char move[32];
+    int movelen = snprintf(move, sizeof(move), "\x1b[%d;1H\x1b[2K", row + 1);
+    ab_append(ab, move, movelen);
+    ab_append(ab, content->buffer, content->bufflen);
+
+    ab_clear(&line->text);
+    ab_append(&line->text, content->buffer, content->bufflen);
+    line->valid = true;
+}
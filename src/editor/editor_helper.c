@@ -1,26 +1,42 @@
 #include "editor.h"
 
-#include <stdlib.h>
-
 #include "rope.h"
 #include "terminal.h"
 
 
-// Converts a cursor column (cx) on the specified line (0-indexed) to its rendered column (rx)
+// Returns the rope index of the first character of a line (served from the cursor cache for the cursor line)
+int get_editor_line_start(int line) {
+    if (line == E.cy)
+        return get_cursor_line_start();
+
+    return get_line_start(E.rope, line);
+}
+
+
+/*
+-> Converts a cursor column (cx) on the specified line (0-indexed) to its rendered column (rx)
+-> Only the first 'cx' characters of the line are visited (directly in the rope's leaves)
+*/
 int cx_to_rx(int line, int cx) {
     int rx = 0;
-    char *buffer = get_line_segment_from_rope(E.rope, line, 0, cx);
-    if (!buffer)
+    RopeIter it;
+    if (!rope_iter_init(&it, E.rope, get_editor_line_start(line)))
         return 0;
 
-    for (int i = 0; i < cx; i++) {
-        if (buffer[i] == '\t')
-            rx += TAB_WIDTH - (rx % TAB_WIDTH);  // snaps to next tab stop
-        else
-            rx++;
+    const char *span;
+    int len;
+    while (cx > 0 && (len = rope_iter_next(&it, &span)) > 0) {
+        for (int i = 0; i < len && cx > 0; i++, cx--) {
+            if (span[i] == '\n')
+                return rx;
+
+            if (span[i] == '\t')
+                rx += TAB_WIDTH - (rx % TAB_WIDTH);  // snaps to next tab stop
+            else
+                rx++;
+        }
     }
 
-    free(buffer);
     return rx;
 }
 
@@ -28,28 +44,36 @@ int cx_to_rx(int line, int cx) {
 /*
 -> Converts a rendered column (rx) on the specified line to its cursor column (cx)
 -> Returns the 'cx' of the end of the line if 'rx' exceeds the rendered width
+-> Stops scanning as soon as 'rx' is reached (doesn't fetch the entire line)
 */
 int rx_to_cx(int line, int rx) {
-    // Fetch entire line because we need to expand tabs
-    int linelen = get_line_length(E.rope, line);
-    char *buffer = get_line_segment_from_rope(E.rope, line, 0, linelen);
-    if (!buffer)
-        return 0;
+    int linelen = 0;
     int cur_rx = 0;
-
-    for (int cx = 0; cx < linelen; cx++) {
-        if (buffer[cx] == '\t')
-            cur_rx += TAB_WIDTH - (cur_rx % TAB_WIDTH);
-        else
-            cur_rx++;
-
-        if (cur_rx > rx) {
-            free(buffer);
-            return cx;
+    RopeIter it;
+    rope_iter_init(&it, E.rope, get_editor_line_start(line));
+
+    const char *span;
+    int len;
+    bool end_of_line = false;
+    while (!end_of_line && (len = rope_iter_next(&it, &span)) > 0) {
+        for (int i = 0; i < len; i++, linelen++) {
+            if (span[i] == '\n') {
+                end_of_line = true;
+                break;
+            }
+
+            if (span[i] == '\t')
+                cur_rx += TAB_WIDTH - (cur_rx % TAB_WIDTH);
+            else
+                cur_rx++;
+
+            if (cur_rx > rx)
+                return linelen;
         }
     }
 
-    free(buffer);
+    if (linelen == 0)
+        return 0;
 
     // Clamp to the end of the line
     if (E.mode == MODE_INSERT)
@@ -89,5 +113,122 @@ int map_vim_nav_key(int ch) {
 
 // Returns the index of the character in the rope corresponding to the current cursor position
 int get_rope_idx_from_cursor(void) {
-    return get_line_start(E.rope, E.cy) + E.cx;
+    return get_cursor_line_start() + E.cx;
+}
+
+
+// Returns the rope index of the first character of the cursor line (E.cy)
+int get_cursor_line_start(void) {
+    if (E.cursor.line != E.cy) {
+        E.cursor.line = E.cy;
+        E.cursor.line_start = get_line_start(E.rope, E.cy);
+        E.cursor.line_len = -1;
+    }
+
+    return E.cursor.line_start;
+}
+
+
+// Returns the length of the cursor line (E.cy) excluding the newline
+int get_cursor_line_length(void) {
+    int start = get_cursor_line_start();
+
+    if (E.cursor.line_len == -1) {
+        int len;
+        if (get_line_spans(E.rope, E.cy, 1, &start, &len) == 0)
+            len = 0;
+
+        E.cursor.line_len = len;
+    }
+
+    return E.cursor.line_len;
+}
+
+
+/*
+-> Records that the cursor line (E.cy) starts at rope index 'start'
+-> Used by motions and edits which can derive the new line start without searching the rope
+*/
+void set_cursor_line_start(int start) {
+    E.cursor.line = E.cy;
+    E.cursor.line_start = start;
+    E.cursor.line_len = -1;
+}
+
+
+// Forgets everything cached about the cursor line (e.g. after jumping to an unrelated position)
+void invalidate_cursor_cache(void) {
+    E.cursor.line = -1;
+    E.cursor.line_start = 0;
+    E.cursor.line_len = -1;
+    E.cursor.iter.leaf = NULL;
+}
+
+
+// Forgets the cached leaf and line length (must be called after every rope edit)
+void drop_cursor_leaf(void) {
+    E.cursor.iter.leaf = NULL;
+    E.cursor.line_len = -1;
+}
+
+
+/*
+-> Returns the character at a given rope index ('\0' if the index is out of range)
+-> Reuses the cached leaf when the index lies in it (or in a leaf right next to it) -> no tree descent
+*/
+char char_at(int idx) {
+    RopeIter *it = &E.cursor.iter;
+
+    // Stepping into a neighbouring leaf reuses the iterator's path (no descent from the root)
+    if (it->leaf != NULL && idx == it->leaf_start + it->leaf->weight)
+        rope_iter_next_leaf(it);
+    else if (it->leaf != NULL && idx == it->leaf_start - 1)
+        rope_iter_prev_leaf(it);
+
+    if (it->leaf == NULL || idx < it->leaf_start || idx >= it->leaf_start + it->leaf->weight) {
+        if (!rope_iter_init(it, E.rope, idx) || idx >= it->leaf_start + it->leaf->weight)
+            return '\0';
+    }
+
+    return it->leaf->str[idx - it->leaf_start];
+}
+
+
+// Adds 'delta' lines to E.numlines (nothing to keep up to date while the lines aren't counted yet)
+void add_numlines(int delta) {
+    if (E.numlines != -1)
+        E.numlines += delta;
+}
+
+
+/*
+-> Returns 'true' if the cursor line (E.cy) is the last line of the text
+-> Works without knowing the number of lines: only the last line runs up to the end of the text
+-> Reaching the last line of a memory-mapped file counts its lines (every leaf has been counted on the way there)
+*/
+bool is_last_line(void) {
+    if (E.numlines != -1)
+        return E.cy >= E.numlines - 1;
+
+    int total_len = E.rope ? E.rope->total_len : 0;
+    if (get_cursor_line_start() + get_cursor_line_length() < total_len)
+        return false;
+
+    E.numlines = count_total_lines(E.rope);
+    return true;
+}
+
+
+/*
+-> Returns 'line' moved up to the last line of the text if it lies past it
+-> The lines of a memory-mapped file are only counted through to the end if 'line' doesn't exist
+*/
+int clamp_line(int line) {
+    if (E.numlines == -1 && get_line_spans(E.rope, line, 1, NULL, NULL) == 0)
+        E.numlines = count_total_lines(E.rope);
+
+    if (E.numlines != -1)
+        return MIN(line, E.numlines - 1);
+
+    return line;
 }
@@ -20,17 +20,37 @@ void init_editor(RopeNode *root, const char *filename) {
     E.coloff = 0;
     E.filename = strdup(filename);
 
-    if (get_window_size(&E.screenrows, &E.screencols) == -1)
-        halt("get_window_size");
-    E.screenrows -= 2;  // leave space at the bottom for status/message bar
+    E.frame.lines = NULL;
+    E.frame.rows = 0;
+    E.frame.rowoff = -1;
+    E.frame.out = (AppendBuffer)ABUF_INIT;
+    E.frame.row = (AppendBuffer)ABUF_INIT;
+    resize_editor();
 
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
     E.is_dirty = false;
     E.is_insert_mode_dirty = false;
+    E.save_queued = false;
 
     E.mode = MODE_NORMAL;
+    E.session.active = false;
 
     E.rope = root;
-    E.numlines = (root == NULL) ? 1 : root->newlines + 1;
+    E.numlines = known_total_lines(root);  // a memory-mapped file isn't counted up front
+    invalidate_cursor_cache();
+    init_undo();
+}
+
+
+// Updates the screen dimensions from the terminal (on start up and whenever the window is resized)
+void resize_editor(void) {
+    if (get_window_size(&E.screenrows, &E.screencols) == -1)
+        halt("get_window_size");
+    E.screenrows -= 2;  // leave space at the bottom for status/message bar
+
+    if (E.screenrows < 1)
+        E.screenrows = 1;
+
+    invalidate_frame();  // the terminal may have reflowed or cleared the screen
 }
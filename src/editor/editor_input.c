@@ -7,23 +7,32 @@
 #include "file_io.h"
 
 
-// Moves cursor position by updating cursor coordinates
+/*
+-> Moves cursor position by updating cursor coordinates
+-> Horizontal moves update 'rx' from the single character crossed (no rescan of the line unless it is a tab)
+*/
 void move_cursor(int key) {
-    int rowsize =  get_line_length(E.rope, E.cy);
-
     // NOTE: cursor coordinates stored in 'E' are 0-indexed
     switch (key) {
         case ARROW_LEFT:
             if (E.cx != 0) {
                 E.cx--;
-                E.rx = cx_to_rx(E.cy, E.cx);
+
+                // Width of a tab depends on everything before it -> recompute only in that case
+                if (char_at(get_rope_idx_from_cursor()) == '\t')
+                    E.rx = cx_to_rx(E.cy, E.cx);
+                else
+                    E.rx--;
                 E.snapx = E.rx;
             }
             break;
 
         case ARROW_DOWN:
-            if (E.cy != E.numlines - 1 && E.numlines > 0) {
+            if (!is_last_line()) {
+                // Next line starts right after the newline of the current one
+                int next_start = get_cursor_line_start() + get_cursor_line_length() + 1;
                 E.cy++;
+                set_cursor_line_start(next_start);
 
                 E.cx = rx_to_cx(E.cy, E.snapx);  // snaps cursor horizontally
                 E.rx = cx_to_rx(E.cy, E.cx);
@@ -32,7 +41,10 @@ void move_cursor(int key) {
 
         case ARROW_UP:
             if (E.cy != 0) {
+                // Previous line ends right before the current one -> walk back to the newline before it
+                int prev_start = find_prev_newline(E.rope, get_cursor_line_start() - 1) + 1;
                 E.cy--;
+                set_cursor_line_start(prev_start);
 
                 E.cx = rx_to_cx(E.cy, E.snapx);  // snaps cursor horizontally
                 E.rx = cx_to_rx(E.cy, E.cx);
@@ -40,11 +52,15 @@ void move_cursor(int key) {
             break;
 
         case ARROW_RIGHT:
+            int rowsize = get_cursor_line_length();
             int limit = (E.mode == MODE_INSERT) ? rowsize : rowsize - 1;
 
             if (E.cx < limit) {
+                if (char_at(get_rope_idx_from_cursor()) == '\t')
+                    E.rx += TAB_WIDTH - (E.rx % TAB_WIDTH);  // snaps to next tab stop
+                else
+                    E.rx++;
                 E.cx++;
-                E.rx = cx_to_rx(E.cy, E.cx);
                 E.snapx = E.rx;
             }
             break;
@@ -53,13 +69,33 @@ void move_cursor(int key) {
 
 
 /*
--> Captures input keypress and executes editor commands
+-> Captures a batch of input keypresses and executes editor commands
+-> Every key which arrived in the same burst is handled before the screen is redrawn again
 -> Returns -1 when quit command is called
 -> Returns 0 if everything works properly
 */
 int process_keypress(void) {
-    int ch = read_key();
+    int keys[KEY_BATCH_SIZE];
+    int count = read_keys(keys, KEY_BATCH_SIZE);
+
+    for (int i = 0; i < count; i++) {
+        save_undo_cursor();
+        if (handle_keypress(keys[i]) == -1)
+            return -1;
+        record_undo_revision();  // every key which changed the text (outside of insert mode) is one change
+        scroll();  // keys like PAGE_UP depend on the viewport left behind by the previous key
+    }
+
+    return 0;
+}
 
+
+/*
+-> Executes the editor command of a single keypress
+-> Returns -1 when quit command is called
+-> Returns 0 if everything works properly
+*/
+int handle_keypress(int ch) {
     switch (E.mode) {
         case MODE_NORMAL:
             // TODO: remove 'return' after moving exit command to command mode
@@ -90,10 +126,7 @@ int handle_normal_keypress(int ch) {
         // TODO: remove this after moving exit command to command mode
         // Save/Quit command
         case CTRL_PLUS('s'):
-            if (save_file(E.rope, E.filename)) {
-                E.is_dirty = false;
-                E.is_insert_mode_dirty = false;
-            }
+            save_buffer();
             break;
         case CTRL_PLUS('q'):
             write(STDOUT_FILENO, "\x1b[2J", 4);  // clear terminal screen
@@ -115,7 +148,7 @@ int handle_normal_keypress(int ch) {
             E.snapx = E.rx;
             break;
         case END_KEY:
-            E.cx =  get_line_length(E.rope, E.cy);
+            E.cx = get_cursor_line_length();
             E.rx = cx_to_rx(E.cy, E.cx);
             E.snapx = E.rx;
             move_cursor(ARROW_LEFT);
@@ -129,11 +162,13 @@ int handle_normal_keypress(int ch) {
                     E.cy = E.rowoff;
                 }
                 else if (ch == PAGE_DOWN) {
-                    E.cy = E.rowoff + E.screenrows - 1;
-                    if (E.cy > E.numlines)
-                        E.cy = E.numlines;
+                    E.cy = clamp_line(E.rowoff + E.screenrows - 1);
                 }
 
+                // Snap the cursor horizontally into the line it jumped to
+                E.cx = rx_to_cx(E.cy, E.snapx);
+                E.rx = cx_to_rx(E.cy, E.cx);
+
                 for (int i = 0; i < E.screenrows; i++) {
                     if (ch == PAGE_UP)
                         move_cursor(ARROW_UP);
@@ -143,6 +178,15 @@ int handle_normal_keypress(int ch) {
             }
             break;
 
+        // Paste text at cursor
+        case PASTE_KEY:
+            insert_text_at_cursor(paste.text, paste.len);
+            E.is_dirty = true;
+            E.is_insert_mode_dirty = false;
+            if (E.cx > 0 && E.cx == get_cursor_line_length())
+                move_cursor(ARROW_LEFT);  // normal mode cursor can't sit past the last character
+            break;
+
         // Delete character at cursor
         case 'x':
         case DEL_KEY:
@@ -150,6 +194,14 @@ int handle_normal_keypress(int ch) {
                 E.is_dirty = true;
             break;
 
+        // Undo/redo
+        case 'u':
+            undo_change();
+            break;
+        case CTRL_PLUS('r'):
+            redo_change();
+            break;
+
         // Switch modes
         case 'i':
         case 'a':
@@ -167,10 +219,15 @@ int handle_normal_keypress(int ch) {
 }
 
 
-// Handles keypresses in insert mode
+/*
+-> Handles keypresses in insert mode
+-> Typed characters and backspaces go through the insert session (see InsertSession)
+-> Every other key commits the session to the rope before it runs
+*/
 void handle_insert_keypress(int ch) {
     switch (ch) {
         case '\x1b':  // Escape key
+            commit_insert_session();
             E.mode = MODE_NORMAL;
             move_cursor(ARROW_LEFT);
             if (E.is_insert_mode_dirty) {
@@ -184,28 +241,40 @@ void handle_insert_keypress(int ch) {
         case ARROW_DOWN:
         case ARROW_UP:
         case ARROW_RIGHT:
+            commit_insert_session();
             move_cursor(ch);
             break;
 
 
         case BACKSPACE:
         case CTRL_PLUS('h'):
-            delete_char_before_cursor();
+            // Joining with the previous line happens directly in the rope
+            if (!session_backspace()) {
+                commit_insert_session();
+                delete_char_before_cursor();
+            }
             break;
 
         case DEL_KEY:
+            commit_insert_session();
             delete_char_at_cursor();
             break;
 
         case '\r':  // Enter key
+            commit_insert_session();
             insert_newline_at_cursor();
             break;
 
+        case PASTE_KEY:
+            commit_insert_session();
+            insert_text_at_cursor(paste.text, paste.len);
+            break;
+
         default:
             // Printable characters have ASCII range from 32 to 126
             // Allow tab character (ASCII 9) to be inserted as well
             if ((ch >= 32 && ch <= 126) || ch == '\t')
-                insert_char_at_cursor(ch);
+                session_insert_char(ch);
             break;
     }
 }
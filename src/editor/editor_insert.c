@@ -6,11 +6,8 @@
 
 // Inserts any character at the current cursor position to the rope
 void insert_at_cursor(char ch) {
-    char str[2];
-    str[0] = ch;
-    str[1] = '\0';
-
-    E.rope = insert_at(E.rope, get_rope_idx_from_cursor(), str);
+    insert_into_rope(get_rope_idx_from_cursor(), &ch, 1);
+    drop_cursor_leaf();  // start of the cursor line is unaffected by the insertion
     E.is_insert_mode_dirty = true;
 }
 
@@ -24,13 +21,46 @@ void insert_char_at_cursor(char ch) {
 
 // Inserts a newline character at the current cursor position
 void insert_newline_at_cursor(void) {
+    int idx = get_rope_idx_from_cursor();
     insert_at_cursor('\n');
 
     E.cy++;
+    set_cursor_line_start(idx + 1);  // new line starts right after the inserted newline
     E.cx = 0;
     E.rx = 0;
     E.snapx = E.rx;
-    E.numlines++;
+    add_numlines(1);
+}
+
+
+/*
+-> Inserts a block of text (e.g. a paste) at the current cursor position with a single rope insertion
+-> Moves the cursor right after the inserted text
+*/
+void insert_text_at_cursor(const char *text, int len) {
+    if (text == NULL || len <= 0)
+        return;
+
+    int idx = get_rope_idx_from_cursor();
+    insert_into_rope(idx, text, len);
+    drop_cursor_leaf();
+
+    int newlines = count_newlines(text, len);
+    if (newlines == 0) {
+        E.cx += len;
+    }
+    else {
+        // Cursor lands on the line after the last inserted newline
+        int last = find_nth_newline(text, len, newlines - 1);
+        E.cy += newlines;
+        add_numlines(newlines);
+        set_cursor_line_start(idx + last + 1);
+        E.cx = len - (last + 1);
+    }
+
+    E.rx = cx_to_rx(E.cy, E.cx);
+    E.snapx = E.rx;
+    E.is_insert_mode_dirty = true;
 }
 
 
@@ -48,13 +78,18 @@ void delete_char_before_cursor(void) {
         move_cursor(ARROW_LEFT);
     else if (E.cy > 0) {
         E.cy--;
-        E.cx = get_line_length(E.rope, E.cy);
+
+        // Cursor lands on the joined newline, at the end of the previous line (found by walking back from it)
+        int start = find_prev_newline(E.rope, idx - 1) + 1;
+        set_cursor_line_start(start);
+        E.cx = (idx - 1) - start;
         E.rx = cx_to_rx(E.cy, E.cx);
         E.snapx = E.rx;
-        E.numlines--;
+        add_numlines(-1);
     }
 
-    E.rope = delete_at(E.rope, idx - 1, 1);
+    delete_from_rope(idx - 1, 1);
+    drop_cursor_leaf();
     E.is_insert_mode_dirty = true;
 }
 
@@ -72,7 +107,7 @@ bool delete_char_at_cursor(void) {
     if (idx >= total_len)
         return false;
 
-    int len = get_line_length(E.rope, E.cy);
+    int len = get_cursor_line_length();
 
     if (E.cx == len) {
         // In normal mode, 'x' does not delete the newline character
@@ -80,14 +115,16 @@ bool delete_char_at_cursor(void) {
             return false;
 
         // In insert mode, DEL deletes the newline character to merge with the next line
-        E.rope = delete_at(E.rope, idx, 1);
-        E.numlines = count_total_lines(E.rope);
+        delete_from_rope(idx, 1);
+        drop_cursor_leaf();
+        E.numlines = known_total_lines(E.rope);
     }
     else {
-        E.rope = delete_at(E.rope, idx, 1);
-        E.numlines = count_total_lines(E.rope);
+        delete_from_rope(idx, 1);
+        drop_cursor_leaf();
+        E.numlines = known_total_lines(E.rope);
 
-        int new_len = get_line_length(E.rope, E.cy);
+        int new_len = get_cursor_line_length();
         if (E.mode == MODE_NORMAL && E.cx == new_len && E.cx > 0)
             move_cursor(ARROW_LEFT);
     }
@@ -0,0 +1,352 @@
+#include "editor.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rope.h"
+#include "terminal.h"
+
+
+/*
+-> Operation log: the UNDO_OPLOG undo backend (see UndoLog)
+-> Every edit is recorded as (offset, removed text, inserted text) -> only changed text is kept, never whole versions
+-> Undo replays the inverse edits of a group backwards, redo replays its edits forwards
+-> Once the log holds more than UNDO_LOG_BUDGET bytes its oldest groups are dropped (compaction)
+-> A long change is cut into groups of at most UNDO_GROUP_BUDGET bytes -> compaction can drop its oldest parts too
+*/
+
+
+// Memory held by an edit (its record + its text)
+static size_t op_size(const UndoOp *op) {
+    return sizeof(UndoOp) + op->removed_len + op->inserted_len;
+}
+
+
+// Starts an empty log
+void init_undo_log(void) {
+    UndoLog *log = &E.undo.log;
+
+    log->ops = NULL;
+    log->op_count = 0;
+    log->op_capacity = 0;
+    log->groups = NULL;
+    log->group_count = 0;
+    log->group_capacity = 0;
+    log->current = 0;
+    log->open = false;
+    log->bytes = 0;
+}
+
+
+// Frees the text of the edits in [first, first + count)
+static void free_ops(int first, int count) {
+    UndoLog *log = &E.undo.log;
+
+    for (int i = first; i < first + count; i++) {
+        log->bytes -= op_size(&log->ops[i]);
+        free(log->ops[i].text);
+    }
+}
+
+
+// Drops the groups which could have been redone (a new edit makes them unreachable)
+static void drop_redo_groups(void) {
+    UndoLog *log = &E.undo.log;
+
+    int kept_ops = 0;
+    if (log->current > 0) {
+        UndoGroup *last = &log->groups[log->current - 1];
+        kept_ops = last->first + last->count;
+    }
+
+    free_ops(kept_ops, log->op_count - kept_ops);
+    log->op_count = kept_ops;
+    log->group_count = log->current;
+}
+
+
+/*
+-> Drops the oldest groups while the log holds more than UNDO_LOG_BUDGET bytes
+-> Drops down to 3/4 of the budget -> the arrays are only shifted once in a while, not on every edit
+-> The open group is only dropped if it holds more than that on its own (a single huge edit) -> the change can't be undone then
+*/
+static void compact_undo_log(void) {
+    UndoLog *log = &E.undo.log;
+    if (log->bytes <= UNDO_LOG_BUDGET)
+        return;
+
+    int groups = 0;
+    int ops = 0;
+    while (groups < log->group_count && log->bytes > UNDO_LOG_BUDGET / 4 * 3) {
+        UndoGroup *group = &log->groups[groups++];
+        free_ops(group->first, group->count);
+        ops += group->count;
+    }
+
+    memmove(log->ops, log->ops + ops, (log->op_count - ops) * sizeof(UndoOp));
+    memmove(log->groups, log->groups + groups, (log->group_count - groups) * sizeof(UndoGroup));
+    log->op_count -= ops;
+    log->group_count -= groups;
+    log->current = MAX(log->current - groups, 0);
+
+    for (int i = 0; i < log->group_count; i++)
+        log->groups[i].first -= ops;
+
+    // The next edit starts a new group if the open one was dropped
+    if (log->group_count == 0)
+        log->open = false;
+}
+
+
+// Copies 'len' characters of the rope starting at index 'idx' into 'dest'
+static void copy_rope_text(char *dest, int idx, int len) {
+    RopeIter it;
+    if (len <= 0 || !rope_iter_init(&it, E.rope, idx))
+        return;
+
+    const char *span;
+    int n;
+    while (len > 0 && (n = rope_iter_next(&it, &span)) > 0) {
+        n = MIN(n, len);
+        memcpy(dest, span, n);
+        dest += n;
+        len -= n;
+    }
+}
+
+
+// Starts a new group (the cursor before the change was remembered by save_undo_cursor())
+static void open_undo_group(void) {
+    UndoLog *log = &E.undo.log;
+
+    drop_redo_groups();
+
+    if (log->group_count == log->group_capacity) {
+        int capacity = (log->group_capacity == 0) ? 64 : log->group_capacity * 2;
+        UndoGroup *new = realloc(log->groups, capacity * sizeof(UndoGroup));
+        if (new == NULL)
+            halt("open_undo_group");
+
+        log->groups = new;
+        log->group_capacity = capacity;
+    }
+
+    UndoGroup *group = &log->groups[log->group_count++];
+    group->first = log->op_count;
+    group->count = 0;
+    group->before_cx = E.undo.start_cx;
+    group->before_cy = E.undo.start_cy;
+    group->after_cx = E.undo.start_cx;
+    group->after_cy = E.undo.start_cy;
+    group->bytes = 0;
+
+    log->current = log->group_count;
+    log->open = true;
+}
+
+
+/*
+-> Tries to merge an edit into the last edit of the open group
+-> Typing extends the text inserted by the last edit, backspacing extends the text removed by it
+-> Returns 'false' if the edits aren't adjacent
+*/
+static bool merge_edit(int idx, int removed_len, const char *inserted, int inserted_len) {
+    UndoLog *log = &E.undo.log;
+    UndoGroup *group = &log->groups[log->group_count - 1];
+    if (group->count == 0)
+        return false;
+
+    UndoOp *last = &log->ops[log->op_count - 1];
+
+    // CASE-1: text inserted right after the text inserted by the last edit
+    if (removed_len == 0 && idx == last->offset + last->inserted_len) {
+        char *text = realloc(last->text, last->removed_len + last->inserted_len + inserted_len);
+        if (text == NULL)
+            halt("merge_edit");
+
+        memcpy(text + last->removed_len + last->inserted_len, inserted, inserted_len);
+        last->text = text;
+        last->inserted_len += inserted_len;
+    }
+
+    // CASE-2: text removed right before the text removed by the last edit (which inserted nothing)
+    else if (inserted_len == 0 && last->inserted_len == 0 && idx + removed_len == last->offset) {
+        char *text = realloc(last->text, removed_len + last->removed_len);
+        if (text == NULL)
+            halt("merge_edit");
+
+        memmove(text + removed_len, text, last->removed_len);
+        copy_rope_text(text, idx, removed_len);
+        last->text = text;
+        last->offset = idx;
+        last->removed_len += removed_len;
+    }
+
+    else {
+        return false;
+    }
+
+    log->bytes += removed_len + inserted_len;
+    group->bytes += removed_len + inserted_len;
+    return true;
+}
+
+
+// Adds an edit to the open group as a new record
+static void append_edit(int idx, int removed_len, const char *inserted, int inserted_len) {
+    UndoLog *log = &E.undo.log;
+
+    if (log->op_count == log->op_capacity) {
+        int capacity = (log->op_capacity == 0) ? 256 : log->op_capacity * 2;
+        UndoOp *new = realloc(log->ops, capacity * sizeof(UndoOp));
+        if (new == NULL)
+            halt("append_edit");
+
+        log->ops = new;
+        log->op_capacity = capacity;
+    }
+
+    UndoOp *op = &log->ops[log->op_count++];
+    op->offset = idx;
+    op->removed_len = removed_len;
+    op->inserted_len = inserted_len;
+    op->text = malloc(MAX(removed_len + inserted_len, 1));
+    if (op->text == NULL)
+        halt("append_edit");
+
+    copy_rope_text(op->text, idx, removed_len);
+    if (inserted_len > 0)
+        memcpy(op->text + removed_len, inserted, inserted_len);
+
+    UndoGroup *group = &log->groups[log->group_count - 1];
+    group->count++;
+    group->bytes += op_size(op);
+    log->bytes += op_size(op);
+}
+
+
+/*
+-> Records an edit which is about to replace 'removed_len' characters at rope index 'idx' by 'inserted'
+-> Must be called before the rope is modified (the removed text is copied from the rope)
+-> An edit too large for UNDO_LOG_BUDGET can't be undone -> the whole log is dropped instead
+-> An edit which would grow the open group past UNDO_GROUP_BUDGET continues the change in a new group
+   -> a long insert mode session (typing, repeated pastes) is undone in parts, but its history stays within UNDO_LOG_BUDGET
+*/
+void log_edit(int idx, int removed_len, const char *inserted, int inserted_len) {
+    UndoLog *log = &E.undo.log;
+    if (E.undo.backend != UNDO_OPLOG)
+        return;
+
+    int total_len = E.rope ? E.rope->total_len : 0;
+    removed_len = MIN(removed_len, total_len - idx);
+    removed_len = MAX(removed_len, 0);
+    inserted_len = MAX(inserted_len, 0);
+    if (removed_len == 0 && inserted_len == 0)
+        return;
+
+    size_t size = sizeof(UndoOp) + removed_len + inserted_len;
+    if (size > UNDO_LOG_BUDGET) {
+        free_undo_log();
+        set_status_message("Change too large to undo");
+        return;
+    }
+
+    // The new group starts where the cursor is now (mid-change)
+    UndoGroup *group = log->open ? &log->groups[log->group_count - 1] : NULL;
+    if (group != NULL && group->count > 0 && group->bytes + size > UNDO_GROUP_BUDGET) {
+        close_undo_group();
+        E.undo.start_cx = E.cx;
+        E.undo.start_cy = E.cy;
+    }
+
+    if (!log->open)
+        open_undo_group();
+
+    if (!merge_edit(idx, removed_len, inserted, inserted_len))
+        append_edit(idx, removed_len, inserted, inserted_len);
+
+    compact_undo_log();
+}
+
+
+// Ends the open group (if any) -> the next edit starts a new change
+void close_undo_group(void) {
+    UndoLog *log = &E.undo.log;
+    if (!log->open)
+        return;
+
+    UndoGroup *group = &log->groups[log->group_count - 1];
+    group->after_cx = E.cx;
+    group->after_cy = E.cy;
+
+    log->open = false;
+}
+
+
+/*
+-> Reverts the last applied group by replaying the inverse of its edits backwards
+-> Returns 'false' if there is nothing to undo
+*/
+bool undo_logged_group(void) {
+    UndoLog *log = &E.undo.log;
+    if (log->current == 0)
+        return false;
+
+    UndoGroup *group = &log->groups[--log->current];
+    for (int i = group->count - 1; i >= 0; i--) {
+        UndoOp *op = &log->ops[group->first + i];
+
+        E.rope = delete_at(E.rope, op->offset, op->inserted_len);
+        E.rope = insert_at(E.rope, op->offset, op->text, op->removed_len);
+    }
+
+    restore_undo_cursor(group->before_cx, group->before_cy);
+    return true;
+}
+
+
+/*
+-> Applies the group after the last applied one again by replaying its edits forwards
+-> Returns 'false' if there is nothing to redo
+*/
+bool redo_logged_group(void) {
+    UndoLog *log = &E.undo.log;
+    if (log->current == log->group_count)
+        return false;
+
+    UndoGroup *group = &log->groups[log->current++];
+    for (int i = 0; i < group->count; i++) {
+        UndoOp *op = &log->ops[group->first + i];
+
+        E.rope = delete_at(E.rope, op->offset, op->removed_len);
+        E.rope = insert_at(E.rope, op->offset, op->text + op->removed_len, op->inserted_len);
+    }
+
+    restore_undo_cursor(group->after_cx, group->after_cy);
+    return true;
+}
+
+
+// Frees every edit of the log
+void free_undo_log(void) {
+    UndoLog *log = &E.undo.log;
+
+    free_ops(0, log->op_count);
+    free(log->ops);
+    free(log->groups);
+    init_undo_log();
+}
+
+
+// Inserts 'len' bytes of text at rope index 'idx' (every insertion made by the editor goes through here to be logged)
+void insert_into_rope(int idx, const char *text, int len) {
+    log_edit(idx, 0, text, len);
+    E.rope = insert_at(E.rope, idx, text, len);
+}
+
+
+// Deletes 'len' characters starting at rope index 'idx' (every deletion made by the editor goes through here to be logged)
+void delete_from_rope(int idx, int len) {
+    log_edit(idx, len, NULL, 0);
+    E.rope = delete_at(E.rope, idx, len);
+}
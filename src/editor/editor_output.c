@@ -10,19 +10,32 @@
 #include "rope.h"
 
 
-// Rebuilds and redraws the entire editor screen in a single buffered write.
+/*
+-> Redraws the editor screen in a single buffered write
+-> Only rows which differ from the previous frame are sent (see Frame)
+-> If nothing but the cursor changed, only the cursor escape sequence is sent
+*/
 void refresh_screen(void) {
     scroll();
 
-    // Accumulate all screen output to 'ab' before writing it to STDOUT in one go
-    AppendBuffer ab = ABUF_INIT;
+    if (E.frame.rows != E.screenrows + 2)
+        resize_frame(E.screenrows + 2);  // text rows + status bar + message bar
+
+    // Accumulate all screen output to the frame's output buffer before writing it to STDOUT in one go
+    // The buffer is only cleared -> after the first frames no allocation happens here
+    AppendBuffer *ab = &E.frame.out;
+    ab_clear(ab);
 
-    ab_append(&ab, "\x1b[?25l", 6);  // hides cursor to prevent flickering while redrawing the screen
-    ab_append(&ab, "\x1b[H", 3);     // moves cursor to the top left of the screen before redrawing the screen
+    ab_append(ab, "\x1b[?25l", 6);  // hides cursor to prevent flickering while redrawing the screen
+    int header = ab->bufflen;
 
-    draw_rows(&ab);
-    draw_status_bar(&ab);
-    draw_message_bar(&ab);
+    scroll_frame(ab);  // shifts rows already on the screen instead of redrawing them
+    draw_rows(ab);
+
+    // Nothing to redraw -> skip hiding the cursor
+    bool redrawn = (ab->bufflen > header);
+    if (!redrawn)
+        ab_clear(ab);
 
     // NOTE: render/cursor coordinates (E.rx, E.cy) are 0-indexed
     // NOTE: use E.rx for horizontal cursor position
@@ -32,78 +45,130 @@ void refresh_screen(void) {
     // Restore cursor to the editor's logical position
     char buffer[32];
     snprintf(buffer, sizeof(buffer), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
-    ab_append(&ab, buffer, strlen(buffer));
+    ab_append(ab, buffer, strlen(buffer));
 
-    ab_append(&ab, "\x1b[?25h", 6);  // displays the cursor after redrawing the screen
+    if (redrawn)
+        ab_append(ab, "\x1b[?25h", 6);  // displays the cursor after redrawing the screen
 
     // Flush the append buffer to STDOUT in one go
-    write(STDOUT_FILENO, ab.buffer, ab.bufflen);
-    ab_free(&ab);
+    write_all(STDOUT_FILENO, ab->buffer, ab->bufflen);
 }
 
 
 /*
--> Renders all visible rows in the editor's viewport
+-> Renders all visible rows in the editor's viewport followed by the status bar and the message bar
+-> Each row is rendered on its own and only appended to 'ab' if it changed (see update_frame_line())
 -> It doesn't actually write to STDOUT
--> It appends all content to the append buffer
 */
 void draw_rows(AppendBuffer *ab) {
+    AppendBuffer *row = &E.frame.row;  // rendering of a single row (reused for every row)
+
+    // Starts of all visible lines are found with a single descent of the rope
+    int starts[E.screenrows];
+    int visible = get_line_spans(E.rope, E.rowoff, E.screenrows, starts, NULL);
+
     for (int line = 0; line < E.screenrows; line++) {
-        ab_append(ab, "\x1b[2K", 4);    // clears current line to prevent artifacts from previous content
+        ab_clear(row);
         int filerow = line + E.rowoff;  // 0-indexed
 
-        if (filerow < E.numlines)
-            draw_line(ab, filerow);
+        if (line < visible)
+            draw_line(row, filerow, starts[line]);
         else
-            ab_append(ab, "~", 1);
+            ab_append(row, "~", 1);
 
-        ab_append(ab, "\r\n", 2);  // add newline after every row
+        update_frame_line(ab, line, row);
     }
+
+    ab_clear(row);
+    draw_status_bar(row);
+    update_frame_line(ab, E.screenrows, row);
+
+    ab_clear(row);
+    draw_message_bar(row);
+    update_frame_line(ab, E.screenrows + 1, row);
 }
 
 
 /*
--> Renders a single row of text (identified by 0-indexed 'filerow') to the screen
--> Expands tabs to spaces and appends visible portions of the line to an append buffer
+-> Renders 'len' characters of 'str' into a row, starting at rendered column '*rx' (which is advanced)
+-> Expands tabs and appends only the characters between E.coloff and the right edge of the screen
+-> Returns 'false' once the row is complete (newline or right edge reached)
 */
-void draw_line(AppendBuffer *ab, int filerow) {
-    // Entire line is fetched because we need to expand tabs and calculate the rendered length of the line
-    int rawlen = get_line_length(E.rope, filerow);
-    char *raw = get_line_segment_from_rope(E.rope, filerow, 0, rawlen);
-
-    if (raw) {
-        int maxlen = MIN((rawlen * TAB_WIDTH) + 1, E.screencols + 1);
-        char *render = calloc(1, maxlen);  // render will only hold characters that will be displayed in screen
-        if (!render)
-            halt("draw_line");
-
-        int renlen = 0;
-        int rx = 0;
-
-        for (int i = 0; i < rawlen && rx < E.coloff + E.screencols; i++) {
-            if (raw[i] == '\n')
-                break;
-
-            // Expand tabs
-            if (raw[i] == '\t') {
-                int spaces = TAB_WIDTH - (rx % TAB_WIDTH);  // spaces required to reach next tab stop
-                while (spaces--) {
-                    if (rx >= E.coloff && rx < E.coloff + E.screencols)
-                        render[renlen++] = ' ';
-                    rx++;
-                }
-            }
-            else {
-                if (rx >= E.coloff && rx < E.coloff + E.screencols)
-                    render[renlen++] = raw[i];
-                rx++;
-            }
+static bool render_chars(AppendBuffer *ab, int *rx, const char *str, int len) {
+    static const char spaces[TAB_WIDTH] = {[0 ... TAB_WIDTH - 1] = ' '};
+    int right = E.coloff + E.screencols;
+    int run = 0;  // start of the pending run of visible characters in 'str'
+    int i;
+
+    for (i = 0; i < len && *rx < right && str[i] != '\n'; i++) {
+        // Expand tabs
+        if (str[i] == '\t') {
+            ab_append(ab, &str[run], i - run);
+            run = i + 1;
+
+            int width = TAB_WIDTH - (*rx % TAB_WIDTH);  // spaces required to reach next tab stop
+            int visible = MIN(*rx + width, right) - MAX(*rx, E.coloff);
+            ab_append(ab, spaces, visible);
+            *rx += width;
         }
+        else {
+            if (*rx < E.coloff)
+                run = i + 1;  // scrolled out to the left
+            (*rx)++;
+        }
+    }
+
+    ab_append(ab, &str[run], i - run);
+    return i == len && *rx < right;
+}
+
 
-        ab_append(ab, render, renlen);
-        free(render);
-        free(raw);
+/*
+-> Renders 'len' characters of the rope starting at index 'idx' into a row (see render_chars())
+-> Pass -1 as 'len' to render up to the end of the line
+-> Returns 'false' once the row is complete
+*/
+static bool render_rope(AppendBuffer *ab, int *rx, int idx, int len) {
+    RopeIter it;
+    if (!rope_iter_init(&it, E.rope, idx))
+        return true;
+
+    const char *span;
+    int n;
+    while (len != 0 && (n = rope_iter_next(&it, &span)) > 0) {
+        if (len != -1 && n > len)
+            n = len;
+
+        if (!render_chars(ab, rx, span, n))
+            return false;
+
+        if (len != -1)
+            len -= n;
     }
+
+    return true;
+}
+
+
+/*
+-> Renders a single row of text (identified by 0-indexed 'filerow' starting at rope index 'start') to the screen
+-> Streams the visible part of the line straight from the rope's leaves into the append buffer (no copies of the line)
+-> Stops at the right edge of the screen -> cost is bounded by the screen width and not by the line length
+*/
+void draw_line(AppendBuffer *ab, int filerow, int start) {
+    int rx = 0;
+
+    if (!is_session_line(filerow)) {
+        render_rope(ab, &rx, start, -1);
+        return;
+    }
+
+    // The line being edited by an insert session is rendered with the session's uncommitted text:
+    // rope text before the gap + typed characters + rope text after the gap
+    InsertSession *s = &E.session;
+    if (render_rope(ab, &rx, start, (s->anchor - s->erased) - start) &&
+            render_chars(ab, &rx, s->pending, s->pending_len))
+        render_rope(ab, &rx, s->anchor, -1);
 }
 
 
@@ -139,9 +204,17 @@ void draw_status_bar(AppendBuffer *ab) {
     else if (E.mode == MODE_COMMAND)
         mode = "COMMAND";
 
+    // The lines of a memory-mapped file are known once the text was walked through to the end
+    if (E.numlines == -1)
+        E.numlines = known_total_lines(E.rope);
+
+    char numlines[16] = "?";
+    if (E.numlines != -1)
+        snprintf(numlines, sizeof(numlines), "%d", E.numlines);
+
     char status[80];
-    int len = snprintf(status, sizeof(status), "  %s  |  %.20s %s  |  %d lines",
-            mode, E.filename, (E.is_dirty) ? "[+]" : "", E.numlines);
+    int len = snprintf(status, sizeof(status), "  %s  |  %.20s %s  |  %s lines",
+            mode, E.filename, (E.is_dirty) ? "[+]" : "", numlines);
 
     if (len > E.screencols)
         len = E.screencols;
@@ -149,7 +222,7 @@ void draw_status_bar(AppendBuffer *ab) {
     ab_append(ab, status, len);
 
     char rstatus[80];
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy + 1, E.numlines);
+    int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%s", E.cy + 1, numlines);
 
     while (len < E.screencols) {
         // Right side of the status bar
@@ -166,7 +239,6 @@ void draw_status_bar(AppendBuffer *ab) {
     }
 
     ab_append(ab, "\x1b[m", 3);  // resets colors to default
-    ab_append(ab, "\r\n", 2);
 }
 
 
@@ -182,6 +254,14 @@ void set_status_message(const char *fmt, ...) {
     vsnprintf(E.statusmsg, sizeof(E.statusmsg), fmt, ap);
     va_end(ap);
     E.statusmsg_time = time(NULL);
+
+    arm_timer(STATUS_MSG_TIMEOUT * 1000);  // wakes the event loop up to clear the message
+}
+
+
+// Clears the status message once it has been displayed for STATUS_MSG_TIMEOUT seconds
+void expire_status_message(void) {
+    E.statusmsg[0] = '\0';
 }
 
 
@@ -191,13 +271,11 @@ void set_status_message(const char *fmt, ...) {
 -> It appends all content to the append buffer
 */
 void draw_message_bar(AppendBuffer *ab) {
-    ab_append(ab, "\x1b[K", 3);  // clears current line to prevent artifacts from previous content
-
     int msglen = strlen(E.statusmsg);
     if (msglen > E.screencols)
         msglen = E.screencols;
 
-    // Display message only if it's less than 5 seconds old
-    if (msglen && time(NULL) - E.statusmsg_time < 5)
+    // Display message only if it's less than STATUS_MSG_TIMEOUT seconds old
+    if (msglen && time(NULL) - E.statusmsg_time < STATUS_MSG_TIMEOUT)
         ab_append(ab, E.statusmsg, msglen);
 }
@@ -0,0 +1,55 @@
+#include "editor.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "rope.h"
+#include "file_io.h"
+#include "terminal.h"
+
+
+/*
+-> Saves the text on a background thread (see start_save()) -> typing goes on while a large file is written
+-> A save requested while another one is running is started once that one ends
+*/
+void save_buffer(void) {
+    if (is_saving()) {
+        E.save_queued = true;
+        set_status_message("Save in progress, saving again once it's done");
+        return;
+    }
+
+    start_save(E.rope, E.filename);
+    set_status_message("Saving \"%s\"...", E.filename);
+}
+
+
+/*
+-> Collects the outcome of the background save once it signalled EVENT_NOTIFY (waits for it otherwise)
+-> The file is only marked as saved if the text wasn't changed meanwhile
+*/
+void complete_save(void) {
+    if (!is_saving())
+        return;
+
+    bool ok;
+    RopeNode *saved = finish_save(&ok);
+
+    if (ok) {
+        // Edits made meanwhile return a new root (the saved one is shared) -> same root = same text
+        if (saved == E.rope && !E.is_insert_mode_dirty)
+            E.is_dirty = false;
+
+        set_status_message("\"%s\" %d bytes written", E.filename, (saved == NULL) ? 0 : saved->total_len);
+    }
+    else {
+        set_status_message("Can't save! %s", strerror(errno));
+    }
+
+    free_rope(saved);
+
+    if (E.save_queued) {
+        E.save_queued = false;
+        save_buffer();
+    }
+}
@@ -0,0 +1,117 @@
+#include "editor.h"
+
+
+#include "rope.h"
+#include "terminal.h"
+
+
+// Starts a new insert session at the current cursor position
+static void begin_insert_session(void) {
+    E.session.active = true;
+    E.session.line = E.cy;
+    E.session.anchor = get_rope_idx_from_cursor();
+    E.session.erased = 0;
+    E.session.pending_len = 0;
+}
+
+
+// Returns the rendered column of the cursor while a session is active (tabs depend on everything before them)
+static int session_cursor_rx(void) {
+    InsertSession *s = &E.session;
+
+    // Rope text before the gap is untouched by the session
+    int rx = cx_to_rx(E.cy, (s->anchor - s->erased) - get_cursor_line_start());
+
+    for (int i = 0; i < s->pending_len; i++) {
+        if (s->pending[i] == '\t')
+            rx += TAB_WIDTH - (rx % TAB_WIDTH);
+        else
+            rx++;
+    }
+
+    return rx;
+}
+
+
+/*
+-> Adds a typed character to the insert session (starting a session if needed) and moves the cursor past it
+-> The rope isn't touched unless the session buffer is full
+*/
+void session_insert_char(char ch) {
+    if (E.session.active && E.session.pending_len == INSERT_SESSION_SIZE)
+        commit_insert_session();
+    if (!E.session.active)
+        begin_insert_session();
+
+    E.session.pending[E.session.pending_len++] = ch;
+
+    if (ch == '\t')
+        E.rx += TAB_WIDTH - (E.rx % TAB_WIDTH);  // snaps to next tab stop
+    else
+        E.rx++;
+    E.cx++;
+    E.snapx = E.rx;
+
+    E.is_insert_mode_dirty = true;
+}
+
+
+/*
+-> Removes the character before the cursor through the insert session
+-> Pops typed characters first, then widens the gap over the rope text before the session
+-> Returns 'false' if the character before the cursor is on the previous line (the caller has to delete it from the rope)
+*/
+bool session_backspace(void) {
+    if (E.cx == 0)
+        return false;
+    if (!E.session.active)
+        begin_insert_session();
+
+    InsertSession *s = &E.session;
+    char ch;
+
+    if (s->pending_len > 0) {
+        ch = s->pending[--s->pending_len];
+    }
+    else {
+        s->erased++;
+        ch = char_at(s->anchor - s->erased);
+    }
+
+    E.cx--;
+    if (ch == '\t')
+        E.rx = session_cursor_rx();
+    else
+        E.rx--;
+    E.snapx = E.rx;
+
+    E.is_insert_mode_dirty = true;
+    return true;
+}
+
+
+/*
+-> Applies the insert session to the rope: one delete_at() for the erased text + one insert_at() for the typed text
+-> Cursor coordinates already describe the committed text, so they are left as is
+*/
+void commit_insert_session(void) {
+    InsertSession *s = &E.session;
+    if (!s->active)
+        return;
+
+    s->active = false;
+
+    int start = s->anchor - s->erased;
+    if (s->erased > 0)
+        delete_from_rope(start, s->erased);
+    if (s->pending_len > 0)
+        insert_into_rope(start, s->pending, s->pending_len);
+
+    drop_cursor_leaf();  // start of the cursor line is unaffected (the session never crosses a newline)
+}
+
+
+// Returns 'true' if the given line is being edited by an uncommitted insert session
+bool is_session_line(int line) {
+    return E.session.active && E.session.line == line;
+}
@@ -0,0 +1,187 @@
+#include "editor.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rope.h"
+#include "terminal.h"
+
+
+/*
+-> The undo history keeps a reference to the root of every version of the text (see UndoHistory)
+-> An edit never modifies nodes shared with a kept version, it copies the nodes on its path instead (see unshare_node())
+-> A change is recorded once a key leaves a new rope behind outside of insert mode -> a whole insert mode session is undone at once
+-> With the UNDO_OPLOG backend the changes are kept as groups of edits instead (see editor_oplog.c)
+*/
+
+
+// Starts the history with the text as it was loaded
+void init_undo(void) {
+    E.undo.backend = UNDO_BACKEND;
+    init_undo_log();
+
+    E.undo.revisions = NULL;
+    E.undo.count = 0;
+    E.undo.capacity = 0;
+    E.undo.current = -1;
+    E.undo.start_cx = 0;
+    E.undo.start_cy = 0;
+
+    if (E.undo.backend == UNDO_SNAPSHOTS)
+        record_undo_revision();
+}
+
+
+// Remembers the cursor before a key is handled, as long as the text still matches the current revision
+void save_undo_cursor(void) {
+    if (E.mode == MODE_INSERT)
+        return;  // the change starts where insert mode was entered
+    if (E.undo.backend == UNDO_OPLOG && E.undo.log.open)
+        return;
+    if (E.undo.backend == UNDO_SNAPSHOTS && E.undo.count > 0 && E.rope != E.undo.revisions[E.undo.current].rope)
+        return;
+
+    E.undo.start_cx = E.cx;
+    E.undo.start_cy = E.cy;
+}
+
+
+/*
+-> Adds the editor's rope to the history if it changed since the current revision (nothing is recorded in insert mode)
+-> Revisions which could have been redone are dropped
+-> The oldest revision is dropped once the history holds UNDO_LEVELS revisions
+-> With the UNDO_OPLOG backend the edits were logged as they were made -> their group is closed instead
+*/
+void record_undo_revision(void) {
+    UndoHistory *h = &E.undo;
+
+    if (E.mode == MODE_INSERT)
+        return;
+    if (h->backend == UNDO_OPLOG) {
+        close_undo_group();
+        return;
+    }
+    if (h->count > 0 && E.rope == h->revisions[h->current].rope)
+        return;  // every edit of a kept version returns a new root -> same root = same text
+
+    for (int i = h->current + 1; i < h->count; i++)
+        free_rope(h->revisions[i].rope);
+    h->count = h->current + 1;
+
+    if (h->count == UNDO_LEVELS) {
+        free_rope(h->revisions[0].rope);
+        memmove(h->revisions, h->revisions + 1, (h->count - 1) * sizeof(UndoRevision));
+        h->count--;
+    }
+
+    if (h->count == h->capacity) {
+        int capacity = (h->capacity == 0) ? 64 : h->capacity * 2;
+        UndoRevision *new = realloc(h->revisions, capacity * sizeof(UndoRevision));
+        if (new == NULL)
+            halt("record_undo_revision");
+
+        h->revisions = new;
+        h->capacity = capacity;
+    }
+
+    UndoRevision *rev = &h->revisions[h->count];
+    rev->rope = retain_rope(E.rope);
+    rev->before_cx = h->start_cx;
+    rev->before_cy = h->start_cy;
+    rev->after_cx = E.cx;
+    rev->after_cy = E.cy;
+
+    h->current = h->count;
+    h->count++;
+}
+
+
+// Puts the cursor at ('cx', 'cy') (clamped to the text) after the text was replaced by undo or redo
+void restore_undo_cursor(int cx, int cy) {
+    E.numlines = known_total_lines(E.rope);
+    invalidate_cursor_cache();
+
+    E.cy = clamp_line(cy);
+    int len = get_cursor_line_length();
+    E.cx = MIN(cx, (len > 0) ? len - 1 : 0);  // normal mode cursor can't sit past the last character
+    E.rx = cx_to_rx(E.cy, E.cx);
+    E.snapx = E.rx;
+
+    E.is_dirty = true;
+}
+
+
+// Makes the editor show the given revision with the cursor at ('cx', 'cy')
+static void show_revision(int index, int cx, int cy) {
+    // O(1): the editor's rope is swapped for the revision's root (no text is copied)
+    free_rope(E.rope);
+    E.rope = retain_rope(E.undo.revisions[index].rope);
+    E.undo.current = index;
+
+    restore_undo_cursor(cx, cy);
+}
+
+
+/*
+-> Goes back to the revision before the current one
+-> Returns 'false' if there is nothing to undo
+*/
+bool undo_change(void) {
+    UndoHistory *h = &E.undo;
+    if (h->backend == UNDO_OPLOG) {
+        if (!undo_logged_group()) {
+            set_status_message("Already at oldest change");
+            return false;
+        }
+        return true;
+    }
+
+    if (h->current <= 0) {
+        set_status_message("Already at oldest change");
+        return false;
+    }
+
+    UndoRevision *undone = &h->revisions[h->current];
+    show_revision(h->current - 1, undone->before_cx, undone->before_cy);
+    return true;
+}
+
+
+/*
+-> Goes forward to the revision after the current one
+-> Returns 'false' if there is nothing to redo
+*/
+bool redo_change(void) {
+    UndoHistory *h = &E.undo;
+    if (h->backend == UNDO_OPLOG) {
+        if (!redo_logged_group()) {
+            set_status_message("Already at newest change");
+            return false;
+        }
+        return true;
+    }
+
+    if (h->current >= h->count - 1) {
+        set_status_message("Already at newest change");
+        return false;
+    }
+
+    UndoRevision *redone = &h->revisions[h->current + 1];
+    show_revision(h->current + 1, redone->after_cx, redone->after_cy);
+    return true;
+}
+
+
+// Drops every revision (and every logged edit) of the history
+void free_undo_history(void) {
+    free_undo_log();
+
+    for (int i = 0; i < E.undo.count; i++)
+        free_rope(E.undo.revisions[i].rope);
+
+    free(E.undo.revisions);
+    E.undo.revisions = NULL;
+    E.undo.count = 0;
+    E.undo.capacity = 0;
+    E.undo.current = -1;
+}
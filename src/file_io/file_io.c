@@ -1,78 +1,482 @@
+#define _GNU_SOURCE  // copy_file_range()
+
 #include "file_io.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "rope.h"
 #include "terminal.h"
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024  // buffers a single writev() accepts (POSIX only guarantees _XOPEN_IOV_MAX = 16)
+#endif
+
+
+// Memory-mapped file whose pages back the borrowed leaves of the rope (see map_file())
+static char *mapping = NULL;
+static size_t mapping_len = 0;
+static int mapping_fd = -1;  // mapped file (stays open -> its text can be copied by the kernel even after the file is replaced)
+
+// Save running on a background thread (see start_save())
+typedef struct SaveJob {
+	bool running;        // 'true' from start_save() until finish_save()
+	pthread_t thread;    // writer thread
+	RopeNode *snapshot;  // version of the text being written (retained until finish_save())
+	char *filename;      // file being written
+	bool ok;             // outcome of save_file()
+	int error;           // errno of the failure (if any)
+} SaveJob;
+
+static SaveJob job = {0};
+
+
+/*
+-> Maps a file into memory and builds a rope of borrowed leaves pointing into the mapping
+-> No text is copied: a leaf is copied to the heap only when it is edited for the first time
+-> No text is read either: leaves are BORROWED_CHUNK_SIZE bytes long and their newlines are counted on first use
+   -> startup doesn't depend on the size of the file and only the pages which are viewed (or edited) are faulted in
+-> The mapping stays alive until unmap_file() is called
+-> Returns NULL (errno is set) if the file can't be mapped
+*/
+static RopeNode *map_file(int fd, const struct stat *st) {
+	size_t len = st->st_size;
+	char *text = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (text == MAP_FAILED)
+		return NULL;
+
+	int count = (len + BORROWED_CHUNK_SIZE - 1) / BORROWED_CHUNK_SIZE;
+	RopeNode **leaves = malloc(count * sizeof(RopeNode *));
+	if (leaves == NULL)
+		halt("map_file");
+
+	for (int i = 0; i < count; i++) {
+		size_t start = (size_t)i * BORROWED_CHUNK_SIZE;
+		leaves[i] = create_borrowed_leaf(text + start, MIN(BORROWED_CHUNK_SIZE, len - start));
+	}
+
+	RopeNode *root = build_rope_from_leaves(leaves, count);
+	free(leaves);
+
+	mapping_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (mapping_fd == -1)
+		halt("map_file");
+
+	mapping = text;
+	mapping_len = len;
+
+	return root;
+}
+
 
 /*
 -> Loads a file into a rope
 -> Returns the root of the rope
 -> Returns an empty rope if file doesn't exist
+-> Regular files of at least MMAP_MIN_SIZE bytes are memory-mapped instead of being read (see map_file())
+-> Leaves are collected first and the rope is built on top of them in one go (no per-chunk concat())
+-> '*ok' is set to 'false' and errno to the cause if the file can't be loaded (EFBIG for files over MAX_FILE_SIZE bytes)
 */
-RopeNode *load_file(const char *filename) {
+RopeNode *load_file(const char *filename, bool *ok) {
+	*ok = true;
 	FILE *fp = fopen(filename, "rb");
 
 	if (!fp) {
         // CASE-A: file doesn't exist -> return empty rope
         if (errno == ENOENT)
             return NULL;
-        // CASE-B: can't load existing file -> exit program
-        else
-            halt("load_file");
+        // CASE-B: can't load existing file -> report it
+        *ok = false;
+        return NULL;
     }
 
-    RopeNode *root = NULL;
-    char buffer[CHUNK_SIZE + 1] = {0};  // +1 for null terminator
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)) {
+        // Rope lengths and indices are 'int's
+        if (st.st_size > MAX_FILE_SIZE) {
+            fclose(fp);
+            errno = EFBIG;
+            *ok = false;
+            return NULL;
+        }
+
+        // Only one file can back borrowed leaves at a time
+        if (mapping == NULL && st.st_size >= MMAP_MIN_SIZE) {
+            RopeNode *root = map_file(fileno(fp), &st);
+            int error = errno;
+            fclose(fp);
+
+            errno = error;
+            *ok = root != NULL;
+            return root;
+        }
+    }
 
-	// Read the file in chunks
+    char buffer[CHUNK_SIZE];
+    RopeNode **leaves = NULL;
+    int count = 0;
+    int capacity = 0;
+
+	// Read the file in chunks (chunks are length-explicit, so '\0' bytes are loaded as is)
 	int n;
 	while ((n = fread(buffer, 1, CHUNK_SIZE, fp)) > 0) {
-		buffer[n] = '\0';                      // terminate buffer
-		RopeNode *leaf = create_leaf(buffer);
-		root = concat(root, leaf);
+		if (count == capacity) {
+			capacity = (capacity == 0) ? 1024 : capacity * 2;
+			RopeNode **new = realloc(leaves, capacity * sizeof(RopeNode *));
+			if (new == NULL)
+				halt("load_file");
+
+			leaves = new;
+		}
+
+		leaves[count++] = create_leaf(buffer, n);
     }
 
     fclose(fp);
+
+    RopeNode *root = build_rope_from_leaves(leaves, count);
+    free(leaves);
+
     return root;
 }
 
 
-// Writes the rope contents to a file recursively
-void write_rope_to_file(RopeNode *node, FILE *fp) {
-	if (node == NULL)
-		return;
+/*
+-> Writes 'count' buffers to 'fd', resuming after partial writes and interruptions
+-> Returns 'false' (errno is set) on failure
+*/
+static bool write_all_iov(int fd, struct iovec *iov, int count) {
+	while (count > 0) {
+		ssize_t n = writev(fd, iov, count);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		// Skip the buffers written in full and trim the one written in part
+		while (count > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return true;
+}
+
+
+// Returns 'true' if a span lies in the mapping and is long enough to be copied by copy_from_mapping()
+static bool is_copyable(const struct iovec *span) {
+	char *start = span->iov_base;
+	return mapping != NULL && start >= mapping && start + span->iov_len <= mapping + mapping_len && span->iov_len >= COPY_RANGE_MIN;
+}
+
+
+/*
+-> Writes a span of the mapping to 'fd' with copy_file_range() -> the kernel copies (or reflinks) the blocks of the mapped file
+-> The text never passes through user space and filesystems with reflinks (btrfs, XFS) share the blocks instead of copying them
+-> Falls back to write() where copy_file_range() isn't supported (e.g. across filesystems)
+-> Returns 'false' (errno is set) on failure
+-> Fails with EIO if the mapped file was truncated by someone else (the mapping past its new end can't be read anymore)
+*/
+static bool copy_from_mapping(int fd, struct iovec *span) {
+	loff_t offset = (char *)span->iov_base - mapping;
+
+	while (span->iov_len > 0) {
+		ssize_t n = copy_file_range(mapping_fd, &offset, fd, NULL, span->iov_len, 0);
+		if (n == -1 && errno == EINTR)
+			continue;
+
+		// End of the source file before the end of the span -> reading the mapping there would raise SIGBUS
+		if (n == 0) {
+			errno = EIO;
+			return false;
+		}
+
+		if (n == -1) {
+			if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)
+				return write_all_iov(fd, span, 1);
+			return false;
+		}
+
+		span->iov_base = (char *)span->iov_base + n;
+		span->iov_len -= n;
+	}
+
+	return true;
+}
+
+
+/*
+-> Writes a batch of spans to 'fd': long spans of the mapping are copied by the kernel, everything else goes through writev()
+-> Returns 'false' (errno is set) on failure
+*/
+static bool write_spans(int fd, struct iovec *iov, int count) {
+	int first = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (!is_copyable(&iov[i]))
+			continue;
+
+		if (!write_all_iov(fd, iov + first, i - first) || !copy_from_mapping(fd, &iov[i]))
+			return false;
+		first = i + 1;
+	}
+
+	return write_all_iov(fd, iov + first, count - first);
+}
+
+
+/*
+-> Writes the rope contents to a file descriptor (no stdio: the spans of the rope are handed to the kernel as they are)
+-> Spans are gathered IOV_MAX at a time into one writev() -> a 256 byte leaf costs an iovec, not a system call
+-> Spans which follow each other in memory (e.g. untouched leaves of a mapped file) are merged into one iovec
+-> Untouched stretches of a mapped file are copied from the file itself (see copy_from_mapping())
+-> 'sync' -> the file is flushed to disk (fsync()) before returning
+-> Returns 'false' (errno is set) on failure
+*/
+bool write_rope_to_fd(RopeNode *root, int fd, bool sync) {
+	struct iovec iov[IOV_MAX];
+	RopeIter it;
+
+	if (rope_iter_init(&it, root, 0)) {
+		const char *span;
+		int len = 0;
+
+		do {
+			int count = 0;
+			while (count < IOV_MAX && (len = rope_iter_next(&it, &span)) > 0) {
+				if (count > 0 && (char *)iov[count - 1].iov_base + iov[count - 1].iov_len == span) {
+					iov[count - 1].iov_len += len;
+					continue;
+				}
+
+				iov[count].iov_base = (void *)span;
+				iov[count].iov_len = len;
+				count++;
+			}
+
+			if (!write_spans(fd, iov, count))
+				return false;
+		} while (len > 0);
+	}
+
+	if (sync && fsync(fd) == -1)
+		return false;
 
-	if (is_leaf(node)) {
-		if (node->str != NULL)
-			fprintf(fp, "%s", node->str);
+	return true;
+}
+
+
+/*
+-> Unmaps the file mapped by load_file() (if any)
+-> Must only be called once no rope refers to the mapping anymore
+*/
+void unmap_file(void) {
+	if (mapping == NULL)
 		return;
+
+	munmap(mapping, mapping_len);
+	close(mapping_fd);
+	mapping = NULL;
+	mapping_len = 0;
+	mapping_fd = -1;
+}
+
+
+/*
+-> Creates a new file next to 'filename' to write the text to (it is renamed over 'filename' once complete)
+-> Returns its file descriptor and stores its name in 'tmpname' (freed by the caller)
+-> Returns -1 (errno is set) if it can't be created
+*/
+static int create_temp_file(const char *filename, mode_t mode, char **tmpname) {
+	size_t len = strlen(filename) + 32;
+	char *name = malloc(len);
+	if (name == NULL)
+		halt("save_file");
+
+	// O_EXCL: never reuse a file which already exists (e.g. left behind by a crash)
+	int fd = -1;
+	for (int attempt = 0; attempt < 100 && fd == -1; attempt++) {
+		snprintf(name, len, "%s.tim-%d-%d", filename, (int)getpid(), attempt);
+		fd = open(name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+		if (fd == -1 && errno != EEXIST)
+			break;
 	}
 
-    // Inorder traversal to preserve the original text order
-	write_rope_to_file(node->left, fp);
-	write_rope_to_file(node->right, fp);
+	if (fd == -1) {
+		free(name);
+		return -1;
+	}
+
+	*tmpname = name;
+	return fd;
 }
 
 
 /*
--> Saves the text in a rope to a file
--> Returns 'true' on success, 'false' on failure
+-> Flushes the directory containing 'filename' to disk, which makes a rename() into it durable
+-> Returns 'false' (errno is set) on failure
+*/
+static bool sync_parent_dir(const char *filename) {
+	char *dir = strdup(filename);
+	if (dir == NULL)
+		halt("save_file");
+
+	char *slash = strrchr(dir, '/');
+	if (slash == dir)
+		slash[1] = '\0';  // file in '/'
+	else if (slash != NULL)
+		*slash = '\0';
+
+	int fd = open((slash != NULL) ? dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	free(dir);
+	if (fd == -1)
+		return false;
+
+	// Some filesystems can't sync directories (EINVAL) -> nothing more can be done there
+	bool ok = fsync(fd) == 0 || errno == EINVAL;
+	int error = errno;
+	close(fd);
+	errno = error;
+
+	return ok;
+}
+
+
+/*
+-> Saves the text in a rope to a file without ever overwriting the old contents in place (crash-safe)
+-> The text is written to a new file next to it, flushed to disk, then renamed over the old file (atomic)
+-> A crash leaves either the old file or the new one, never a partly written file
+-> SAVE_FSYNC -> the new file and its directory are flushed (fsync()) so the new contents also survive a power loss
+-> The old inode is never truncated, so the mapping on top of it (and the borrowed leaves) stay intact
+-> Permissions and ownership of the old file are kept, symbolic links are followed
+-> Returns 'true' on success, 'false' on failure (errno is set), the old file is left untouched then
+-> Only reads the rope -> safe to run on another thread while the editor works on later versions of the text
 */
 bool save_file(RopeNode *root, const char *filename) {
-	if (filename == NULL)
+	if (filename == NULL) {
+		errno = EINVAL;
 		return false;
+	}
 
-	FILE *fp = fopen(filename, "w");
-	if (!fp) {
-		halt("save_file");
+	// Replace the file a symbolic link points to, not the link itself
+	char *target = realpath(filename, NULL);
+	if (target == NULL && errno != ENOENT)
+		return false;
+	const char *path = (target != NULL) ? target : filename;
+
+	struct stat st;
+	bool exists = stat(path, &st) == 0;
+	mode_t mode = exists ? (st.st_mode & 07777) : 0666;
+
+	char *tmpname;
+	int fd = create_temp_file(path, mode, &tmpname);
+	if (fd == -1) {
+		free(target);
+		return false;
+	}
+
+	if (exists) {
+		fchmod(fd, mode);                   // umask may have dropped some permission bits
+		fchown(fd, st.st_uid, st.st_gid);  // best effort: fails for files owned by another user
 	}
 
-	write_rope_to_file(root, fp);
-	fclose(fp);
+	bool ok = write_rope_to_fd(root, fd, SAVE_FSYNC);
+	if (close(fd) == -1)
+		ok = false;
+	if (ok && rename(tmpname, path) == -1)
+		ok = false;
 
+	if (!ok) {
+		int error = errno;
+		unlink(tmpname);
+		errno = error;
+	}
+	else if (SAVE_FSYNC) {
+		ok = sync_parent_dir(path);
+	}
+
+	free(tmpname);
+	free(target);
+	return ok;
+}
+
+
+// Body of the writer thread started by start_save()
+static void *save_worker(void *arg) {
+	(void)arg;
+
+	job.ok = save_file(job.snapshot, job.filename);
+	job.error = errno;
+
+	notify_event();  // wakes the event loop up -> finish_save()
+	return NULL;
+}
+
+
+/*
+-> Starts saving the text in a rope to a file on a background thread and returns right away
+-> The rope is retained (O(1)): later edits copy the nodes they change, so the thread reads a frozen version of the text
+-> Once the file is written the event loop receives EVENT_NOTIFY -> finish_save() collects the outcome
+-> Returns 'false' if a save is already running
+*/
+bool start_save(RopeNode *root, const char *filename) {
+	if (job.running)
+		return false;
+
+	job.snapshot = retain_rope(root);
+	job.filename = strdup(filename);
+	if (job.filename == NULL)
+		halt("start_save");
+
+	int error = pthread_create(&job.thread, NULL, save_worker, NULL);
+	if (error != 0) {
+		errno = error;
+		halt("start_save");
+	}
+
+	job.running = true;
 	return true;
 }
+
+
+// Returns 'true' while a save started by start_save() hasn't been collected by finish_save()
+bool is_saving(void) {
+	return job.running;
+}
+
+
+/*
+-> Waits for the running save to end (if it hasn't yet) and collects its outcome
+-> Returns the version of the text that was written -> the caller releases it with free_rope() (ropes are never released by the writer thread)
+-> '*ok' is set to 'false' and errno to the cause if the file couldn't be written
+-> Must only be called while is_saving()
+*/
+RopeNode *finish_save(bool *ok) {
+	pthread_join(job.thread, NULL);
+
+	RopeNode *snapshot = job.snapshot;
+	free(job.filename);
+	job.snapshot = NULL;
+	job.filename = NULL;
+	job.running = false;
+
+	*ok = job.ok;
+	errno = job.error;
+	return snapshot;
+}
@@ -1,16 +1,28 @@
 #ifndef FILE_IO_H
 #define FILE_IO_H
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 
 #include "rope.h"
 
+#define MAX_FILE_SIZE INT_MAX  // largest file load_file() accepts (rope lengths are 'int's -> 2 GiB)
+#define MMAP_MIN_SIZE (4 * 1024 * 1024)  // files of at least this many bytes are memory-mapped by load_file()
+#define SAVE_FSYNC true  // 'true' -> save_file() flushes the new file and its directory to disk (fsync()) before reporting success
+#define COPY_RANGE_MIN (64 * 1024)  // untouched stretches of a mapped file of at least this many bytes are copied by the kernel when saving
+
 
 // File operations
-RopeNode *load_file(const char *filename);
-void write_rope_to_file(RopeNode *node, FILE *fp);
+RopeNode *load_file(const char *filename, bool *ok);
+bool write_rope_to_fd(RopeNode *root, int fd, bool sync);
 bool save_file(RopeNode *root, const char *filename);
+void unmap_file(void);
+
+// Background save operations
+bool start_save(RopeNode *root, const char *filename);
+bool is_saving(void);
+RopeNode *finish_save(bool *ok);
 
 
 #endif
@@ -18,20 +18,51 @@ int main(int argc, char **argv) {
 	}
 
     char *filename = argv[1];
-	RopeNode *root = load_file(filename);
+    bool loaded;
+	RopeNode *root = load_file(filename, &loaded);
+	if (!loaded) {
+		perror(filename);
+		return 1;
+	}
 
     enable_raw();
+    init_events();
     init_editor(root, filename);
 
     set_status_message("HELP: Ctrl-Q = quit | Ctrl-S = save");
 
-    while(true) {
+    // Event loop: sleeps until there is input, a resize, an expired timer or a finished save and redraws once per wake up
+    bool running = true;
+    while (running) {
         refresh_screen();
-        if (process_keypress() == -1)
-            break;
+
+        switch (wait_event()) {
+            case EVENT_INPUT:
+                if (process_keypress() == -1)
+                    running = false;
+                break;
+            case EVENT_RESIZE:
+                resize_editor();
+                break;
+            case EVENT_TIMER:
+                expire_status_message();
+                break;
+            case EVENT_NOTIFY:
+                complete_save();
+                break;
+        }
     }
 
+    // A save still running (or queued) is finished before the text it reads is released
+    while (is_saving())
+        complete_save();
+
+    free_undo_history();
 	free_rope(E.rope);
+    close_events();
+    free_frame();
+    unmap_file();
+    pool_destroy();
     free(E.filename);
 	return 0;
 }
@@ -2,10 +2,13 @@
 #define ROPE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
-#define CHUNK_SIZE 256
+#define CHUNK_SIZE 256  // must not exceed BORROWED_CHUNK_SIZE
+#define BORROWED_CHUNK_SIZE (64 * 1024)  // max length of a borrowed leaf (offsets within a chunk are stored in 16 bits)
+#define NEWLINES_UNKNOWN (-1)  // 'newlines' of a subtree whose borrowed text hasn't been counted yet (see node_newlines())
 
 
 /*
@@ -19,36 +22,80 @@ typedef struct RopeNode {
 	int total_len;  // total number of characters under the subtree rooted at this node
 	char *str;      // contains a text chunk (only in leaf nodes)
 	int height;     // height of the subtree rooted at this node (used in AVL rotations)
-	int newlines;   // count of '\n's in the subtree rooted at this node (used by the text cursor)
+	int newlines;   // count of '\n's in the subtree rooted at this node (used by the text cursor) or NEWLINES_UNKNOWN
+	unsigned short *line_offsets;  // offsets of the '\n's in the text chunk (only in leaf nodes, built on first use, see get_line_offsets())
+
+	int refs;       // number of references to the node (parents in every version of the rope + roots held outside the rope)
 
 	struct RopeNode *left;
 	struct RopeNode *right;
-	struct RopeNode *parent;
+
+	char data[];    // inline storage for the text chunk (only allocated in leaf nodes, not null terminated)
 
     // NOTE: 'weight' helps in O(log n) indexing while 'total_len' helps to calculate weights
 } RopeNode;
 
+// Size of a leaf node: the node itself followed by room for CHUNK_SIZE bytes of text
+#define LEAF_NODE_SIZE (sizeof(RopeNode) + CHUNK_SIZE)
+
 /*
 # LEAF NODES
 - left = right = NULL
-- str = chunk of text
-- weight = strlen(str)
+- str = data = chunk of text (at most CHUNK_SIZE bytes stored right after the node's metadata)
+- weight = length of the chunk in bytes (explicit, so chunks may contain '\0's)
+- newlines = count of '\n's in the chunk (computed once when the leaf is created)
+- line_offsets = NULL or a table of 'newlines' offsets of the '\n's in the chunk (fits in 16 bits since chunks are at most BORROWED_CHUNK_SIZE bytes)
+
+# BORROWED LEAF NODES
+- same as leaf nodes, except that 'str' points into memory owned by someone else (e.g. a memory-mapped file)
+- no inline 'data' is allocated -> the node is as small as an internal node
+- up to BORROWED_CHUNK_SIZE bytes long -> a large file needs few nodes
+- newlines = NEWLINES_UNKNOWN until the text is counted on first use (see node_newlines()) -> loading doesn't touch the text
+- read-only: it is replaced by a regular leaf holding a copy of its text the first time it is edited (once split down to CHUNK_SIZE bytes)
 
 # INTERNAL NODES
 - at least one child is not NULL
 - str = NULL
 - weight = total length of text in all the leaf nodes from the left subtree
+- newlines = NEWLINES_UNKNOWN if the count of either subtree is unknown
+
+# SHARED NODES (persistent ropes)
+- a node may belong to several versions of a rope at once (e.g. the versions kept by the undo history)
+- 'refs' counts the references to a node -> it is freed by free_rope() once nobody refers to it anymore
+- shared nodes (refs > 1) are never modified: edits copy the nodes on their way instead (path copying, see unshare_node())
+- a node may have a different parent in every version -> nodes have no parent or neighbour pointers, walks go top-down
+- insert_at(), delete_at(), concat() and split() hand the caller's references over to their results
 */
 
 
+#define ROPE_ITER_DEPTH 64  // max depth of a rope walked by a RopeIter (AVL balanced ropes stay far below this)
+
+/*
+-> Position in a rope used for sequential reads (see rope_iter.c)
+-> Yields the text as contiguous spans straight from the leaves, forward or backward
+-> Only valid until the rope is modified
+*/
+typedef struct RopeIter {
+	RopeNode *stack[ROPE_ITER_DEPTH];  // path from the root to the current leaf
+	int depth;                         // number of nodes in 'stack'
+	RopeNode *leaf;                    // current leaf (NULL if the iterator is invalid)
+	int leaf_start;                    // rope index of the first byte of 'leaf'
+	int offset;                        // position within 'leaf' (0 <= offset <= weight)
+} RopeIter;
+
+
 // Core functions
-RopeNode *create_leaf(const char *text);
+RopeNode *create_leaf(const char *text, int len);
+RopeNode *create_borrowed_leaf(const char *text, int len);
 RopeNode *concat(RopeNode *left, RopeNode *right);
 void split(RopeNode *root, int idx, RopeNode **left, RopeNode **right);
-RopeNode *build_rope(const char *text);
-RopeNode *insert_at(RopeNode *root, int idx, const char *text);
+RopeNode *build_rope(const char *text, int len);
+RopeNode *build_rope_from_leaves(RopeNode **leaves, int count);
+RopeNode *insert_at(RopeNode *root, int idx, const char *text, int len);
 RopeNode *delete_at(RopeNode *root, int start, int len);
 void free_rope(RopeNode *root);
+RopeNode *retain_rope(RopeNode *root);
+RopeNode *unshare_node(RopeNode *node);
 
 // AVL balancing
 int get_skew(RopeNode *node);
@@ -58,22 +105,42 @@ RopeNode *rebalance(RopeNode *node);
 
 // Helper functions
 bool is_leaf(RopeNode *node);
+bool is_borrowed(RopeNode *node);
 int node_height(RopeNode *node);
-int string_length(const char *str);
-int count_newlines(const char *str);
+int node_newlines(RopeNode *node);
 void update_metadata(RopeNode *node);
-char *string_copy(const char *src);
-char *substr_copy(const char *start, int n);
+const unsigned short *get_line_offsets(RopeNode *leaf);
+void drop_line_offsets(RopeNode *leaf);
+
+// Iterator
+bool rope_iter_init(RopeIter *it, RopeNode *root, int idx);
+bool rope_iter_init_newline(RopeIter *it, RopeNode *root, int newline_idx, int *rank);
+int rope_iter_pos(const RopeIter *it);
+int rope_iter_next(RopeIter *it, const char **span);
+int rope_iter_prev(RopeIter *it, const char **span);
+bool rope_iter_next_leaf(RopeIter *it);
+bool rope_iter_prev_leaf(RopeIter *it);
+
+// Newline kernels (SIMD accelerated)
+int count_newlines(const char *str, int len);
+int find_nth_newline(const char *str, int len, int n);
+int list_newlines(const char *str, int len, unsigned short *offsets);
+
+// Memory pool
+void *pool_alloc(size_t size);
+void pool_free(void *ptr, size_t size);
+void pool_destroy(void);
 
 // Utility functions
 int find_newline_pos(RopeNode *node, int newline_idx, int offset);
+int find_prev_newline(RopeNode *root, int idx);
 int get_line_start(RopeNode *root, int line);
 int get_line_length(RopeNode *root, int line);
+int get_line_spans(RopeNode *root, int first, int count, int *starts, int *lengths);
 int count_total_lines(RopeNode *root);
+int known_total_lines(RopeNode *root);
 char *get_line_segment_from_rope(RopeNode *root, int line, int start, int maxlen);
 RopeNode *leaf_at(RopeNode *node, int idx, int *offset);
-RopeNode *next_leaf(RopeNode *node);
-RopeNode *successor_node(RopeNode *node);
 
 
 #endif
@@ -14,7 +14,8 @@ int get_skew(RopeNode *node) {
 
 /*
 -> Performs a right rotation at a given node
--> Returns the root of the new subtree
+-> Returns the root of the new subtree (the caller's reference to 'node' is handed over to it)
+-> Both rotated nodes are modified -> shared ones are copied first (see unshare_node())
 */
 RopeNode *rotate_right(RopeNode *node) {
 	/*
@@ -37,29 +38,15 @@ RopeNode *rotate_right(RopeNode *node) {
 	if (node == NULL || node->left == NULL)
 		return node;
 
-	RopeNode *y = node;
-	RopeNode *x = y->left;
+	RopeNode *y = unshare_node(node);
+	RopeNode *x = unshare_node(y->left);
 	RopeNode *B = x->right;
 
-	// Shift the parent of y to become the parent of x
-	RopeNode *parent = node->parent;
-	y->parent = NULL;
-	x->parent = parent;
-	if (parent != NULL) {
-		if (parent->left == y)
-			parent->left = x;
-		else
-			parent->right = x;
-	}
-
 	// Shift y to be the right child of x
 	x->right = y;
-	y->parent = x;
 
 	// Move B
 	y->left = B;
-	if (B != NULL)
-		B->parent = y;
 
 	update_metadata(y);
 	update_metadata(x);
@@ -70,7 +57,8 @@ RopeNode *rotate_right(RopeNode *node) {
 
 /*
 -> Performs a left rotation at a given node
--> Returns the root of the new subtree
+-> Returns the root of the new subtree (the caller's reference to 'node' is handed over to it)
+-> Both rotated nodes are modified -> shared ones are copied first (see unshare_node())
 */
 RopeNode *rotate_left(RopeNode *node) {
 	/*
@@ -93,30 +81,15 @@ RopeNode *rotate_left(RopeNode *node) {
 	if (node == NULL || node->right == NULL)
 		return node;
 
-	RopeNode *x = node;
-	RopeNode *y = x->right;
+	RopeNode *x = unshare_node(node);
+	RopeNode *y = unshare_node(x->right);
 	RopeNode *B = y->left;
 
-	// Shift the parent of x to become the parent of y
-	RopeNode *parent = node->parent;
-	x->parent = NULL;
-	y->parent = parent;
-	if (parent != NULL) {
-		if (parent->left == x)
-			parent->left = y;
-		else
-			parent->right = y;
-	}
-
 	// Shift x to be the left child of y
 	y->left = x;
-	x->parent = y;
 
 	// Move B
 	x->right = B;
-	if (B != NULL) {
-		B->parent = x;
-	}
 
 	update_metadata(x);
 	update_metadata(y);
@@ -126,7 +99,7 @@ RopeNode *rotate_left(RopeNode *node) {
 
 
 /*
--> Rebalances the subtree rooted at 'node'
+-> Rebalances the subtree rooted at 'node' ('node' itself must not be shared, see unshare_node())
 -> Returns the new subtree root
 */
 RopeNode *rebalance(RopeNode *node) {
@@ -149,7 +122,7 @@ RopeNode *rebalance(RopeNode *node) {
 
 		// SUB-CASE-B: (right_skew = -1) -> one right rotation on the right node + one left rotation on the root node
 		else if (right_skew == -1) {
-			update_metadata(rotate_right(node->right));
+			node->right = rotate_right(node->right);
 			RopeNode *result = rotate_left(node);
 			update_metadata(result);
 			return result;
@@ -169,7 +142,7 @@ RopeNode *rebalance(RopeNode *node) {
 
 		// SUB-CASE-B: (left_skew = 1) -> one left rotation on the left node + one right rotation on the root node
 		else if (left_skew == 1) {
-			update_metadata(rotate_left(node->left));
+			node->left = rotate_left(node->left);
 			RopeNode *result = rotate_right(node);
 			update_metadata(result);
 			return result;
@@ -1,26 +1,207 @@
 #include "rope.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "terminal.h"
 
 
-// Creates a leaf node from the given text chunk
-RopeNode *create_leaf(const char *text) {
-	RopeNode *node = calloc(1, sizeof(RopeNode));	
-	if (node == NULL)
-		halt("create_leaf");
+#define PATH_INLINE_DEPTH 64  // path entries kept on the C stack (taller trees spill to the heap)
+
+
+/*
+-> A step of a walk down the rope: a node and the child the walk continued with
+-> split() records the sibling subtree it leaves behind instead of the node (the node itself is taken apart)
+*/
+typedef struct PathEntry {
+	RopeNode *node;
+	bool went_left;  // 'true' if the walk continued with the left child
+} PathEntry;
+
+/*
+-> Explicit stack of the nodes visited by a walk down the rope (used instead of recursion and parent pointers)
+-> Its capacity is derived from node heights, so it is bounded even if the rope is temporarily unbalanced
+*/
+typedef struct Path {
+	PathEntry *entries;
+	int count;
+	PathEntry inline_entries[PATH_INLINE_DEPTH];
+} Path;
+
+
+// Prepares an empty path which can hold 'capacity' entries
+static void path_init(Path *path, int capacity) {
+	path->count = 0;
+	path->entries = path->inline_entries;
+
+	if (capacity > PATH_INLINE_DEPTH) {
+		path->entries = malloc(capacity * sizeof(PathEntry));
+		if (path->entries == NULL)
+			halt("path_init");
+	}
+}
+
+
+// Releases the memory of a path (if it spilled to the heap)
+static void path_free(Path *path) {
+	if (path->entries != path->inline_entries)
+		free(path->entries);
+}
+
+
+// Records a step of the walk
+static void path_push(Path *path, RopeNode *node, bool went_left) {
+	path->entries[path->count].node = node;
+	path->entries[path->count].went_left = went_left;
+	path->count++;
+}
+
+
+/*
+-> Creates a leaf node from the first 'len' bytes of 'text' (which may contain '\0's)
+-> The text is stored inline right after the node's metadata (a single pool allocation per leaf)
+-> At most CHUNK_SIZE bytes fit in a leaf (use build_rope() for longer text)
+-> The leaf's length and newline count are computed here once and maintained by edits afterwards
+*/
+RopeNode *create_leaf(const char *text, int len) {
+	RopeNode *node = pool_alloc(LEAF_NODE_SIZE);
 
-	node->str = string_copy(text);
+	len = MIN(MAX(len, 0), CHUNK_SIZE);
+	if (len > 0)
+		memcpy(node->data, text, len);
+	node->str = node->data;
+
+	node->weight = len;
+	node->newlines = count_newlines(node->str, len);
+	node->refs = 1;
 	update_metadata(node);
 
 	return node;
 }
 
 
+/*
+-> Creates a leaf node that refers to 'len' bytes of 'text' without copying them
+-> 'text' must stay valid (and unchanged) for as long as the leaf exists
+-> Used to back leaves directly by a memory-mapped file
+-> At most BORROWED_CHUNK_SIZE bytes are borrowed by a leaf
+-> The text isn't read here: its newlines are counted the first time they are needed (see node_newlines())
+*/
+RopeNode *create_borrowed_leaf(const char *text, int len) {
+	RopeNode *node = pool_alloc(sizeof(RopeNode));  // no inline storage needed
+
+	len = MIN(MAX(len, 0), BORROWED_CHUNK_SIZE);
+	node->str = (char *)text;
+
+	node->weight = len;
+	node->newlines = NEWLINES_UNKNOWN;
+	node->refs = 1;
+	update_metadata(node);
+
+	return node;
+}
+
+
+// Returns a node (along with its inline text chunk in case of leaves) to the rope's memory pool
+static void release_node(RopeNode *node) {
+	drop_line_offsets(node);
+
+	if (node->str != NULL && !is_borrowed(node))
+		pool_free(node, LEAF_NODE_SIZE);
+	else
+		pool_free(node, sizeof(RopeNode));
+}
+
+
+// Creates an internal node with the given subtrees as its children (the node takes over the caller's references to them)
+static RopeNode *create_internal(RopeNode *left_subtree, RopeNode *right_subtree) {
+	RopeNode *node = pool_alloc(sizeof(RopeNode));
+
+	node->left = left_subtree;
+	node->right = right_subtree;
+	node->refs = 1;
+
+	update_metadata(node);
+	return node;
+}
+
+
+/*
+-> Adds a reference to a rope and returns it (e.g. to keep a version of the text in the undo history)
+-> The rope stays alive until every reference is dropped with free_rope()
+*/
+RopeNode *retain_rope(RopeNode *root) {
+	if (root != NULL)
+		root->refs++;
+
+	return root;
+}
+
+
+/*
+-> Returns a node which can be modified in place of 'node' (the caller's reference to 'node' is handed over to it)
+-> A node shared with other versions of the rope is copied (path copying) -> those versions never see the modification
+-> The copy refers to the same children (and the same borrowed text) as the original
+*/
+RopeNode *unshare_node(RopeNode *node) {
+	if (node == NULL || node->refs == 1)
+		return node;
+
+	RopeNode *copy;
+	if (!is_leaf(node))
+		copy = create_internal(retain_rope(node->left), retain_rope(node->right));
+	else if (is_borrowed(node)) {
+		copy = create_borrowed_leaf(node->str, node->weight);
+		copy->newlines = node->newlines;
+	}
+	else
+		copy = create_leaf(node->str, node->weight);
+
+	node->refs--;
+	return copy;
+}
+
+
+/*
+-> Makes sure that a leaf is exclusively owned and owns its text chunk before the chunk is modified in place
+-> The leaf must be at most CHUNK_SIZE bytes long
+-> Shared or borrowed leaves are replaced by a regular leaf holding a copy of their text (the caller's reference is handed over to it)
+-> Returns the leaf which can be modified
+*/
+static RopeNode *own_leaf(RopeNode *leaf) {
+	if (leaf->refs == 1 && !is_borrowed(leaf))
+		return leaf;
+
+	RopeNode *owned = create_leaf(leaf->str, leaf->weight);
+	free_rope(leaf);
+
+	return owned;
+}
+
+
+/*
+-> Takes the children out of an internal node and drops the caller's reference to the node
+-> The caller holds a reference to each child afterwards (the node is freed unless another version of the rope uses it)
+*/
+static void open_node(RopeNode *node, RopeNode **left, RopeNode **right) {
+	*left = node->left;
+	*right = node->right;
+
+	if (node->refs == 1) {
+		release_node(node);  // the node's references to its children move to the caller
+		return;
+	}
+
+	node->refs--;
+	retain_rope(*left);
+	retain_rope(*right);
+}
+
+
 /*
 -> Concatenates two subtrees and returns the root of the new subtree
 -> Rebalances the new concatenated subtree too
+-> The caller's references to both subtrees are handed over to the result (shared nodes on the way are copied)
 */
 RopeNode *concat(RopeNode *left_subtree, RopeNode *right_subtree) {
 	if (left_subtree == NULL)
@@ -28,163 +209,289 @@ RopeNode *concat(RopeNode *left_subtree, RopeNode *right_subtree) {
 	if (right_subtree == NULL)
 		return left_subtree;
 
-	RopeNode *concatenated_root = NULL;
-	int skew = node_height(right_subtree) - node_height(left_subtree);
-
+	// The walk goes down one spine per step -> it can't be longer than both heights together
+	Path path;
+	path_init(&path, node_height(left_subtree) + node_height(right_subtree));
 
-	// CASE-1: There isn't much height difference between left_subtree and right_subtree
-	if (skew >= -1 && skew <= 1) {
-		concatenated_root = calloc(1, sizeof(RopeNode));
-		if (concatenated_root == NULL)
-			halt("concat");
+	// Walk down until there isn't much height difference between the two subtrees
+	// NOTE: every node on the way gets a new child below -> shared ones are copied first
+	while (left_subtree != NULL && right_subtree != NULL) {
+		int skew = node_height(right_subtree) - node_height(left_subtree);
 
-		concatenated_root->left = left_subtree;
-		concatenated_root->right = right_subtree;
-
-		left_subtree->parent = concatenated_root;
-		right_subtree->parent = concatenated_root;
-
-		update_metadata(concatenated_root);
-		return concatenated_root;
-	}
+		// Right subtree is heavier -> attach left_subtree deep in the left spine of right_subtree
+		if (skew >= 2) {
+			right_subtree = unshare_node(right_subtree);
+			path_push(&path, right_subtree, true);
+			right_subtree = right_subtree->left;
+		}
 
-	// CASE-2: Right subtree is heavier -> attach left_subtree deep in the left spine of right_subtree
-	else if (skew >= 2) {
-		// Recurse down the left spine of right_subtree to find the perfect spot for concatenating (|skew| <= 1)
-		right_subtree->left = concat(left_subtree, right_subtree->left);
-		if (right_subtree->left)
-			right_subtree->left->parent = right_subtree;
+		// Left subtree is heavier -> attach right_subtree deep in the right spine of left_subtree
+		else if (skew <= -2) {
+			left_subtree = unshare_node(left_subtree);
+			path_push(&path, left_subtree, false);
+			left_subtree = left_subtree->right;
+		}
 
-		concatenated_root = right_subtree;
+		else {
+			break;
+		}
 	}
 
-	// CASE-3: Left subtree is heavier -> attach right_subtree deep in the right spine of left_subtree
-	else if (skew <= -2) {
-		// Recurse down the right spine of left_subtree to find the perfect spot for concatenating (|skew| <= 1)
-		left_subtree->right = concat(left_subtree->right, right_subtree);
-		if (left_subtree->right)
-			left_subtree->right->parent = left_subtree;
-
-		concatenated_root = left_subtree;
+	RopeNode *joined;
+	if (left_subtree == NULL)
+		joined = right_subtree;
+	else if (right_subtree == NULL)
+		joined = left_subtree;
+	else
+		joined = create_internal(left_subtree, right_subtree);
+
+	// Hang the joined subtree back in place and rebalance on the way up
+	while (path.count > 0) {
+		PathEntry step = path.entries[--path.count];
+
+		if (step.went_left)
+			step.node->left = joined;
+		else
+			step.node->right = joined;
+
+		update_metadata(step.node);
+		joined = rebalance(step.node);
 	}
 
-	update_metadata(concatenated_root);
-	return rebalance(concatenated_root);
+	path_free(&path);
+	return joined;
 }
 
 
 /*
 -> Splits a rope into two subtrees at the given index
 -> Stores the resulting left and right subtrees in 'left' and 'right'
+-> The caller's reference to 'node' is handed over to the results (nodes shared with other versions are left intact)
 */
 void split(RopeNode *node, int idx, RopeNode **left, RopeNode **right) {
-	if (node == NULL) {
-		*left = NULL;
-		*right = NULL;
+	*left = NULL;
+	*right = NULL;
+	if (node == NULL)
 		return;
+
+	Path path;
+	path_init(&path, node_height(node));
+
+	// Walk down to the leaf holding the split point, taking every node on the way apart
+	while (node != NULL && !is_leaf(node)) {
+		bool go_left = idx < node->weight;
+		if (!go_left)
+			idx -= node->weight;  // adjust idx relative to the right subtree
+
+		RopeNode *left_child, *right_child;
+		open_node(node, &left_child, &right_child);
+
+		// The sibling of the child the walk goes into ends up entirely on one side of the split
+		if (go_left) {
+			path_push(&path, right_child, true);
+			node = left_child;
+		}
+		else {
+			path_push(&path, left_child, false);
+			node = right_child;
+		}
 	}
 
-	// BASE CASE
-	if (is_leaf(node)) {
-		int len = string_length(node->str);
+	// Split the leaf
+	if (node != NULL) {
+		int len = node->weight;
 
 		// SUB-CASE-A: split before the leaf
 		if (idx <= 0) {
-			*left = NULL;
 			*right = node;
 		}
 
 		// SUB-CASE-B: split after the leaf
 		else if (idx >= len) {
 			*left = node;
-			*right = NULL;
 		}
 
-		// SUB-CASE-C: split the leaf into two
+		// SUB-CASE-C: split the leaf into two (halves of a borrowed leaf keep borrowing the same text)
 		else {
-			char *left_str = substr_copy(node->str, idx);
-			char *right_str = substr_copy(node->str + idx, len - idx);
+			if (is_borrowed(node)) {
+				*left = create_borrowed_leaf(node->str, idx);
+				*right = create_borrowed_leaf(node->str + idx, len - idx);
+
+				// A counted leaf keeps its halves counted (only the shorter half is scanned)
+				if (node->newlines != NEWLINES_UNKNOWN) {
+					if (idx <= len - idx) {
+						(*left)->newlines = count_newlines(node->str, idx);
+						(*right)->newlines = node->newlines - (*left)->newlines;
+					}
+					else {
+						(*right)->newlines = count_newlines(node->str + idx, len - idx);
+						(*left)->newlines = node->newlines - (*right)->newlines;
+					}
+				}
+			}
+			else {
+				*left = create_leaf(node->str, idx);
+				*right = create_leaf(node->str + idx, len - idx);
+			}
+
+			free_rope(node);
+		}
+	}
 
-			*left = create_leaf(left_str);
-			*right = create_leaf(right_str);
+	// Walk back up: the sibling subtree of every step is joined to the side of the split it lies on
+	while (path.count > 0) {
+		PathEntry step = path.entries[--path.count];
 
-			free(left_str);
-			free(right_str);
-			free(node->str);
-			free(node);
-		}
+		// CASE-1: split point was in the left subtree -> the right subtree goes to the right side
+		if (step.went_left)
+			*right = concat(*right, step.node);
 
-		return;
+		// CASE-2: split point was in the right subtree -> the left subtree goes to the left side
+		else
+			*left = concat(step.node, *left);
 	}
 
-	// CASE-1: required index is in the left subtree -> split the left subtree
-	if (idx < node->weight) {
-		RopeNode *left_split;   // of the left subtree
-		RopeNode *right_split;  // of the left subtree
-
-		split(node->left, idx, &left_split, &right_split);
+	path_free(&path);
+}
 
-        // 'node' will be freed later -> detach its children to avoid dangling pointers
-        if (node->right)
-            node->right->parent = NULL;
-        if (left_split)
-            left_split->parent = NULL;
 
-		*right = concat(right_split, node->right);
-		*left = left_split;
+/*
+-> Builds a balanced subtree over 'count' consecutive chunks of 'text' starting from chunk number 'first'
+-> Both halves get (almost) the same number of chunks, so sibling heights never differ by more than 1
+*/
+static RopeNode *build_chunks(const char *text, int len, int first, int count) {
+	if (count == 1) {
+		int start = first * CHUNK_SIZE;
+		return create_leaf(text + start, MIN(CHUNK_SIZE, len - start));
 	}
 
-	// CASE-2: required index is in the right subtree -> split the right subtree
-	else {
-		RopeNode *left_split;   // of the right subtree
-		RopeNode *right_split;  // of the right subtree
+	int half = count / 2;
+	RopeNode *left_subtree = build_chunks(text, len, first, half);
+	RopeNode *right_subtree = build_chunks(text, len, first + half, count - half);
 
-		split(node->right, idx - node->weight, &left_split, &right_split);  // adjust idx relative to the right subtree
+	return create_internal(left_subtree, right_subtree);
+}
 
-        // 'node' will be freed later -> detach its children to avoid dangling pointers
-        if (node->left)
-            node->left->parent = NULL;
-        if (right_split)
-            right_split->parent = NULL;
 
-		*left = concat(node->left, left_split);
-		*right = right_split;
-	}
+/*
+-> Builds a rope from the first 'len' bytes of 'text'
+-> Returns the root of the rope
+-> The rope is built in one pass (O(n)) as a perfectly balanced tree -> no concat() or rotations
+*/
+RopeNode *build_rope(const char *text, int len) {
+	if (text == NULL || len <= 0)
+		return NULL;
 
-	free(node);
+	int chunks = (len + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	return build_chunks(text, len, 0, chunks);
+}
+
+
+// Builds a balanced subtree over 'count' leaves (in text order)
+static RopeNode *build_leaves(RopeNode **leaves, int count) {
+	if (count == 1)
+		return leaves[0];
+
+	int half = count / 2;
+	RopeNode *left_subtree = build_leaves(leaves, half);
+	RopeNode *right_subtree = build_leaves(leaves + half, count - half);
+
+	return create_internal(left_subtree, right_subtree);
 }
 
 
 /*
--> Builds a rope from the given string of text
+-> Builds a rope on top of an array of 'count' leaves (in text order)
 -> Returns the root of the rope
+-> The rope is built in one pass (O(n)) as a perfectly balanced tree -> no concat() or rotations
 */
-RopeNode *build_rope(const char *text) {
-	if (text == NULL)
+RopeNode *build_rope_from_leaves(RopeNode **leaves, int count) {
+	if (leaves == NULL || count <= 0)
 		return NULL;
 
-	int len = string_length(text);
-	RopeNode *root = NULL;
+	return build_leaves(leaves, count);
+}
 
-	for (int i = 0; i < len; i += CHUNK_SIZE) {
-		char *buffer = substr_copy(text + i, CHUNK_SIZE);
-		RopeNode *leaf = create_leaf(buffer);
-		root = concat(root, leaf);
-		free(buffer);
+
+/*
+-> Walks from the root to the leaf holding index 'idx' and records the internal nodes on the way in 'path'
+-> With 'prefer_left', an index at a leaf boundary goes to the leaf on the left (where text is inserted, see insert_at())
+-> Stores the index's offset within the leaf in 'offset' (0 <= offset <= weight)
+*/
+static RopeNode *walk_to_leaf(RopeNode *node, int idx, bool prefer_left, Path *path, int *offset) {
+	while (node != NULL && !is_leaf(node)) {
+		bool go_left = node->left != NULL && (idx < node->weight || (prefer_left && idx == node->weight) || node->right == NULL);
+		path_push(path, node, go_left);
+
+		if (go_left) {
+			node = node->left;
+		}
+		else {
+			idx -= node->weight;
+			node = node->right;
+		}
 	}
 
-	return root;
+	*offset = idx;
+	return node;
+}
+
+
+/*
+-> Makes every node of a walk recorded by walk_to_leaf() exclusively owned, copying the shared ones (path copying)
+-> Updates 'root' and the nodes in 'path' to their copies
+-> Returns the leaf the walk ended at, which owns its text and can be modified in place afterwards
+*/
+static RopeNode *own_path(RopeNode **root, Path *path) {
+	RopeNode **link = root;
+
+	for (int i = 0; i < path->count; i++) {
+		RopeNode *node = unshare_node(*link);
+		*link = node;
+		path->entries[i].node = node;
+
+		link = path->entries[i].went_left ? &node->left : &node->right;
+	}
+
+	*link = own_leaf(*link);  // borrowed text is copied on its first modification
+	return *link;
+}
+
+
+/*
+-> Adds 'len_delta' characters and 'newline_delta' newlines to a leaf and all of its ancestors (the nodes in 'path')
+-> Weights only change in ancestors whose left subtree contains the leaf
+-> Heights don't change, so the rope stays balanced without any rotations
+-> Ancestors whose newlines aren't counted yet stay uncounted (the leaf itself is always counted, see own_leaf())
+*/
+static void propagate_delta(Path *path, RopeNode *leaf, int len_delta, int newline_delta) {
+	drop_line_offsets(leaf);  // the chunk changed -> its newline offsets are stale
+
+	leaf->weight += len_delta;
+	leaf->total_len += len_delta;
+	leaf->newlines += newline_delta;
+
+	for (int i = 0; i < path->count; i++) {
+		RopeNode *node = path->entries[i].node;
+
+		if (path->entries[i].went_left)
+			node->weight += len_delta;
+		node->total_len += len_delta;
+		if (node->newlines != NEWLINES_UNKNOWN)
+			node->newlines += newline_delta;
+	}
 }
 
 
 /*
--> Inserts a string of text to a rope at a given index
--> Returns the new root of the rope after insertion
+-> Inserts 'len' bytes of text to a rope at a given index
+-> Returns the new root of the rope after insertion (the caller's reference to 'root' is handed over to it)
+-> Text that fits in the spare room of the target leaf is inserted in place (no rotations, only shared nodes on the path are copied)
 */
-RopeNode *insert_at(RopeNode *root, int idx, const char *text) {
+RopeNode *insert_at(RopeNode *root, int idx, const char *text, int len) {
 	if (root == NULL)
-		return build_rope(text);
-	if (text == NULL)
+		return build_rope(text, len);
+	if (text == NULL || len <= 0)
 		return root;
 
 	if (idx < 0)
@@ -192,10 +499,28 @@ RopeNode *insert_at(RopeNode *root, int idx, const char *text) {
 	else if (idx > root->total_len)
 		idx = root->total_len;
 
+	// FAST PATH: shift the tail of the leaf's text chunk and copy the new text into the gap
+	Path path;
+	path_init(&path, node_height(root));
+
+	int offset;
+	RopeNode *leaf = walk_to_leaf(root, idx, true, &path, &offset);
+	if (leaf != NULL && leaf->weight + len <= CHUNK_SIZE) {
+		leaf = own_path(&root, &path);
+
+		memmove(leaf->str + offset + len, leaf->str + offset, leaf->weight - offset);
+		memcpy(leaf->str + offset, text, len);
+
+		propagate_delta(&path, leaf, len, count_newlines(text, len));
+		path_free(&path);
+		return root;
+	}
+	path_free(&path);
+
 	RopeNode *left, *right;
 	split(root, idx, &left, &right);
 
-	RopeNode *middle = build_rope(text);
+	RopeNode *middle = build_rope(text, len);
 
 	RopeNode *new_root;
 	new_root = concat(left, middle);
@@ -207,7 +532,8 @@ RopeNode *insert_at(RopeNode *root, int idx, const char *text) {
 
 /*
 -> Deletes 'len' characters from the rope starting at index 'start'
--> Returns the new root of the rope after deletion
+-> Returns the new root of the rope after deletion (the caller's reference to 'root' is handed over to it)
+-> Deletions that stay inside a single leaf are done in place (no rotations, only shared nodes on the path are copied)
 */
 RopeNode *delete_at(RopeNode *root, int start, int len) {
 	if (root == NULL || len <= 0)
@@ -220,6 +546,25 @@ RopeNode *delete_at(RopeNode *root, int start, int len) {
 	if (start + len > root->total_len)
 		len = root->total_len - start;
 
+	// FAST PATH: deleted text lies within a single small leaf and doesn't empty it -> close the gap in place
+	// NOTE: larger (borrowed) leaves are split instead, their text is never copied in full
+	Path path;
+	path_init(&path, node_height(root));
+
+	int offset;
+	RopeNode *leaf = walk_to_leaf(root, start, false, &path, &offset);
+	if (leaf != NULL && leaf->weight <= CHUNK_SIZE && offset + len <= leaf->weight && len < leaf->weight) {
+		leaf = own_path(&root, &path);
+
+		int deleted_newlines = count_newlines(leaf->str + offset, len);
+		memmove(leaf->str + offset, leaf->str + offset + len, leaf->weight - offset - len);
+
+		propagate_delta(&path, leaf, -len, -deleted_newlines);
+		path_free(&path);
+		return root;
+	}
+	path_free(&path);
+
 	// root -> left + mid
 	RopeNode *left = NULL;
 	RopeNode *mid = NULL;
@@ -238,22 +583,36 @@ RopeNode *delete_at(RopeNode *root, int start, int len) {
 }
 
 
-// Recursively frees all nodes and their text chunks in a rope
+/*
+-> Drops a reference to a rope
+-> Nodes which no other version of the rope uses anymore are returned (with their text chunks) to the memory pool
+*/
 void free_rope(RopeNode *node) {
-	if (node == NULL)
+	if (node == NULL || --node->refs > 0)
 		return;
 
-	// Free children first: Post Order
-	free_rope(node->left);
-	free_rope(node->right);
+	// No stack at all: unreferenced left children are rotated up until the current node has none, then it is freed
+	// NOTE: 'node' is always unreferenced here, subtrees still used elsewhere only lose a reference
+	while (node != NULL) {
+		RopeNode *left = node->left;
+
+		if (left != NULL && left->refs == 1) {
+			node->left = left->right;
+			left->right = node;  // 'left' now holds the only reference to 'node'
+			node->refs = 1;
+			left->refs = 0;
+			node = left;
+			continue;
+		}
 
-	if (node->str != NULL)
-		free(node->str);
+		if (left != NULL)
+			left->refs--;
 
-	node->left = NULL;
-	node->right = NULL;
-	node->parent = NULL;
-	node->str = NULL;
+		RopeNode *right = node->right;
+		release_node(node);
 
-	free(node);
+		node = NULL;
+		if (right != NULL && --right->refs == 0)
+			node = right;
+	}
 }
@@ -1,10 +1,7 @@
 #include "rope.h"
 
-#include <stdlib.h>
 #include <string.h>
 
-#include "terminal.h"
-
 
 // Returns true if the node has no children
 bool is_leaf(RopeNode *node) {
@@ -18,6 +15,15 @@ bool is_leaf(RopeNode *node) {
 }
 
 
+// Returns true if the node is a leaf whose text chunk lives outside the node (see create_borrowed_leaf())
+bool is_borrowed(RopeNode *node) {
+	if (node == NULL || node->str == NULL)
+		return false;
+
+	return node->str != node->data;
+}
+
+
 /*
 -> Returns the height of the subtree rooted at 'node'
 -> Returns zero if subtree doesn't exist
@@ -30,46 +36,16 @@ int node_height(RopeNode *node) {
 }
 
 
-/*
--> Returns the length of a string
--> Returns zero if NULL string is passed
-*/
-int string_length(const char *str) {
-	if (str != NULL)
-		return strlen(str);
-	else
-		return 0;
-}
-
-
-/*
--> Returns the number '\n's in a string
--> Returns zero if NULL string is passed
-*/
-int count_newlines(const char *str) {
-	if (str == NULL)
-		return 0;
-
-	int count = 0;
-	for (int i = 0; str[i] != '\0'; i++)
-		if (str[i] == '\n')
-			count++;
-
-	return count;
-}
-
-
 // Recomputes total_len, weight, height and newlines of a node
 void update_metadata(RopeNode *node) {
 	if (node == NULL)
 		return;
 
 	// CASE 1: node = leaf node
+	// NOTE: a leaf's length (weight) and newline count are set once by create_leaf() -> no rescanning here
 	if (is_leaf(node)) {
-		node->total_len = string_length(node->str);
-		node->weight = node->total_len;              // weight of a leaf node = strlen(node->str)
+		node->total_len = node->weight;
 		node->height = 1;
-		node->newlines = count_newlines(node->str);
 	}
 
 	// CASE 2: node = internal node
@@ -82,41 +58,62 @@ void update_metadata(RopeNode *node) {
 
 		node->height = 1 + MAX(node_height(node->left), node_height(node->right));
 
-		node->newlines = 0;
-		if (node->left)
-			node->newlines += node->left->newlines;
-		if (node->right)
-			node->newlines += node->right->newlines;
+		// A subtree which isn't fully counted yet leaves the sum unknown (see node_newlines())
+		int left_newlines = node->left ? node->left->newlines : 0;
+		int right_newlines = node->right ? node->right->newlines : 0;
+		if (left_newlines == NEWLINES_UNKNOWN || right_newlines == NEWLINES_UNKNOWN)
+			node->newlines = NEWLINES_UNKNOWN;
+		else
+			node->newlines = left_newlines + right_newlines;
 	}
 }
 
 
-// Returns a newly allocated copy of a given string
-char *string_copy(const char *src) {
-	char *dst = malloc(string_length(src) + 1);  // +1 for null character
-	if (dst == NULL)
-		halt("string_copy");
+/*
+-> Returns the count of '\n's in the subtree rooted at 'node'
+-> Borrowed leaves which haven't been counted yet are counted now and the counts are cached on the way back up
+-> Only the uncounted parts of the subtree are visited -> every byte is scanned at most once
+-> Returns zero if subtree doesn't exist
+*/
+int node_newlines(RopeNode *node) {
+	if (node == NULL)
+		return 0;
+
+	if (node->newlines == NEWLINES_UNKNOWN) {
+		if (is_leaf(node))
+			node->newlines = count_newlines(node->str, node->weight);
+		else
+			node->newlines = node_newlines(node->left) + node_newlines(node->right);
+	}
 
-	strcpy(dst, src);
-	return dst;
+	return node->newlines;
 }
 
 
-// Returns a newly allocated copy of the first 'n' characters of a given string
-char *substr_copy(const char *start, int n) {
-	if (start == NULL)
+/*
+-> Returns the offsets of the '\n's in a leaf's text chunk ('leaf->newlines' entries, in increasing order)
+-> The table is built with one scan of the chunk (SIMD kernel, see list_newlines()) the first time it is needed and reused until the chunk changes
+-> Returns NULL if the leaf has no newlines
+*/
+const unsigned short *get_line_offsets(RopeNode *leaf) {
+	if (leaf == NULL || node_newlines(leaf) == 0)
 		return NULL;
-	if (n > string_length(start)) {
-		n = string_length(start);
-	}
 
-    char *dst = malloc(n + 1);  // +1 for null character
-    if (dst == NULL) {
-		halt("substr_cpy");
-		exit(EXIT_FAILURE);
+	if (leaf->line_offsets == NULL) {
+		unsigned short *table = pool_alloc(leaf->newlines * sizeof(unsigned short));
+		list_newlines(leaf->str, leaf->weight, table);
+		leaf->line_offsets = table;
 	}
 
-	strncpy(dst, start, n);
-	dst[n] = '\0';           // Add null terminator
-	return dst;
+	return leaf->line_offsets;
+}
+
+
+// Frees a leaf's newline offset table (must be called before the leaf's text or newline count changes)
+void drop_line_offsets(RopeNode *leaf) {
+	if (leaf == NULL || leaf->line_offsets == NULL)
+		return;
+
+	pool_free(leaf->line_offsets, leaf->newlines * sizeof(unsigned short));
+	leaf->line_offsets = NULL;
 }
@@ -0,0 +1,250 @@
+#include "rope.h"
+
+
+/*
+-> A RopeIter is a position in a rope (between two bytes) which moves over the text one contiguous span at a time
+-> It remembers the path from the root to its current leaf in an explicit stack
+-> Moving to a neighbouring leaf only revisits the part of the path that changes (no successor walks)
+-> Ropes have no parent or neighbour pointers (nodes may be shared by several versions, see rope.h) -> every sequential walk goes through a RopeIter
+*/
+
+
+// Descends from the node on top of the stack to its leftmost (or rightmost) leaf, pushing every node on the way
+static void descend(RopeIter *it, bool leftmost) {
+	RopeNode *node = it->stack[it->depth - 1];
+
+	while (!is_leaf(node)) {
+		if (leftmost)
+			node = node->left ? node->left : node->right;
+		else
+			node = node->right ? node->right : node->left;
+
+		it->stack[it->depth++] = node;
+	}
+}
+
+
+/*
+-> Moves the iterator to the next (or previous) leaf in the rope
+-> Returns false (leaving the iterator unchanged) if there is no such leaf
+*/
+static bool step_leaf(RopeIter *it, bool forward) {
+	int depth = it->depth;
+
+	// Climb until the path can turn towards the requested direction
+	while (depth > 1) {
+		RopeNode *child = it->stack[depth - 1];
+		RopeNode *parent = it->stack[depth - 2];
+		RopeNode *sibling = forward ? parent->right : parent->left;
+
+		if (sibling != NULL && sibling != child) {
+			it->stack[depth - 1] = sibling;
+			it->depth = depth;
+			descend(it, forward);
+
+			RopeNode *leaf = it->stack[it->depth - 1];
+			if (forward) {
+				it->leaf_start += it->leaf->weight;
+				it->offset = 0;
+			}
+			else {
+				it->leaf_start -= leaf->weight;
+				it->offset = leaf->weight;
+			}
+			it->leaf = leaf;
+
+			return true;
+		}
+
+		depth--;
+	}
+
+	return false;
+}
+
+
+/*
+-> Positions an iterator right before the byte at index 'idx' of a rope
+-> 'idx' equal to the length of the rope positions the iterator at the end
+-> Returns false if 'idx' is out of range or the rope is empty
+*/
+bool rope_iter_init(RopeIter *it, RopeNode *root, int idx) {
+	it->depth = 0;
+	it->leaf = NULL;
+	it->leaf_start = 0;
+	it->offset = 0;
+
+	if (root == NULL || idx < 0 || idx > root->total_len)
+		return false;
+
+	RopeNode *node = root;
+	it->stack[it->depth++] = node;
+
+	while (!is_leaf(node)) {
+		// Go right only if the position lies past the left subtree (the end of the rope stays in the last leaf)
+		if (node->left != NULL && (idx < node->weight || node->right == NULL)) {
+			node = node->left;
+		}
+		else {
+			idx -= node->weight;
+			it->leaf_start += node->weight;
+			node = node->right;
+		}
+
+		it->stack[it->depth++] = node;
+	}
+
+	it->leaf = node;
+	it->offset = idx;
+	return true;
+}
+
+
+/*
+-> Moves the iterator from the subtree on top of its stack to the subtree that follows it in the rope
+-> 'leaf_start' is the rope index of the first byte of the subtree on top of the stack
+-> Every ancestor left behind has been walked through in full -> its newline count is cached on the way
+-> Returns false at the end of the rope
+*/
+static bool skip_subtree(RopeIter *it) {
+	it->leaf_start += it->stack[it->depth - 1]->total_len;
+
+	while (it->depth > 1) {
+		RopeNode *child = it->stack[it->depth - 1];
+		RopeNode *parent = it->stack[it->depth - 2];
+
+		if (child == parent->left && parent->right != NULL) {
+			it->stack[it->depth - 1] = parent->right;
+			return true;
+		}
+
+		it->depth--;
+		node_newlines(parent);  // both children are counted by now
+	}
+
+	return false;
+}
+
+
+/*
+-> Positions an iterator right before a given newline (0-based 'newline_idx') of a rope
+-> Stores the rank of the newline within the iterator's leaf in 'rank'
+-> Subtrees whose newlines aren't counted yet are searched leaf by leaf -> only the text up to the newline is counted
+-> Returns false if 'newline_idx' is out of range
+*/
+bool rope_iter_init_newline(RopeIter *it, RopeNode *root, int newline_idx, int *rank) {
+	it->depth = 0;
+	it->leaf = NULL;
+	it->leaf_start = 0;
+	it->offset = 0;
+
+	if (root == NULL || newline_idx < 0)
+		return false;
+
+	it->stack[it->depth++] = root;
+
+	while (true) {
+		RopeNode *node = it->stack[it->depth - 1];
+		int newlines = is_leaf(node) ? node_newlines(node) : node->newlines;  // leaves are cheap to count on the spot
+
+		// CASE-1: the newline lies past this subtree
+		if (newlines != NEWLINES_UNKNOWN && newline_idx >= newlines) {
+			newline_idx -= newlines;
+			if (!skip_subtree(it)) {
+				it->depth = 0;
+				it->leaf_start = 0;
+				return false;
+			}
+		}
+
+		// CASE-2: the leaf holds the newline
+		else if (is_leaf(node)) {
+			break;
+		}
+
+		// CASE-3: the newline lies in this subtree (or its count is unknown) -> search from its first child
+		else {
+			it->stack[it->depth++] = node->left ? node->left : node->right;
+		}
+	}
+
+	RopeNode *node = it->stack[it->depth - 1];
+	it->leaf = node;
+	it->offset = get_line_offsets(node)[newline_idx];
+	*rank = newline_idx;
+	return true;
+}
+
+
+// Returns the rope index of the byte right after the iterator's position
+int rope_iter_pos(const RopeIter *it) {
+	return it->leaf_start + it->offset;
+}
+
+
+/*
+-> Returns the longest contiguous span of bytes after the iterator's position (through 'span') and moves past it
+-> Returns the length of the span or 0 at the end of the rope
+-> The span points into the rope and stays valid until the rope is modified
+*/
+int rope_iter_next(RopeIter *it, const char **span) {
+	if (it->leaf == NULL)
+		return 0;
+
+	while (it->offset == it->leaf->weight) {
+		if (!step_leaf(it, true))
+			return 0;
+	}
+
+	int len = it->leaf->weight - it->offset;
+	*span = it->leaf->str + it->offset;
+	it->offset = it->leaf->weight;
+
+	return len;
+}
+
+
+/*
+-> Returns the longest contiguous span of bytes before the iterator's position (through 'span') and moves before it
+-> Returns the length of the span or 0 at the start of the rope
+-> The span is read forward: it starts at '*span' and ends right before the old position
+*/
+int rope_iter_prev(RopeIter *it, const char **span) {
+	if (it->leaf == NULL)
+		return 0;
+
+	while (it->offset == 0) {
+		if (!step_leaf(it, false))
+			return 0;
+	}
+
+	int len = it->offset;
+	*span = it->leaf->str;
+	it->offset = 0;
+
+	return len;
+}
+
+
+/*
+-> Moves the iterator to the start of the next leaf
+-> Returns false (leaving the iterator unchanged) at the last leaf
+*/
+bool rope_iter_next_leaf(RopeIter *it) {
+	if (it->leaf == NULL)
+		return false;
+
+	return step_leaf(it, true);
+}
+
+
+/*
+-> Moves the iterator to the end of the previous leaf
+-> Returns false (leaving the iterator unchanged) at the first leaf
+*/
+bool rope_iter_prev_leaf(RopeIter *it) {
+	if (it->leaf == NULL)
+		return false;
+
+	return step_leaf(it, false);
+}
@@ -0,0 +1,126 @@
+#include "rope.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "terminal.h"
+
+
+#define POOL_GRANULARITY 16                                    // spacing between two consecutive size classes (in bytes)
+#define POOL_MAX_SIZE 512                                      // largest request served by the pool
+#define POOL_CLASSES (POOL_MAX_SIZE / POOL_GRANULARITY)        // number of size classes
+#define POOL_SLAB_SIZE (64 * 1024)                             // bytes requested from malloc() per slab
+
+
+/*
+-> A slab is a large block carved into equally sized objects of one size class
+-> Slabs are chained together so that pool_destroy() can release them
+-> The header is padded to POOL_GRANULARITY bytes to keep the objects aligned
+*/
+typedef union PoolSlab {
+	union PoolSlab *next;
+	char pad[POOL_GRANULARITY];
+} PoolSlab;
+
+// A free object stores the link to the next free object of the same size class inside itself
+typedef struct PoolObject {
+	struct PoolObject *next;
+} PoolObject;
+
+
+static PoolObject *free_lists[POOL_CLASSES];  // free objects of each size class
+static PoolSlab *slabs = NULL;                // all slabs allocated so far
+
+
+// Returns the size class serving requests of 'size' bytes
+static int size_class(size_t size) {
+	if (size == 0)
+		size = 1;
+
+	return (size - 1) / POOL_GRANULARITY;
+}
+
+
+// Allocates a new slab for a size class and pushes all of its objects to the class's free list
+static void grow_class(int cls) {
+	size_t obj_size = (size_t)(cls + 1) * POOL_GRANULARITY;
+
+	PoolSlab *slab = malloc(POOL_SLAB_SIZE);
+	if (slab == NULL)
+		halt("grow_class");
+
+	slab->next = slabs;
+	slabs = slab;
+
+	char *obj = (char *)slab + sizeof(PoolSlab);
+	char *end = (char *)slab + POOL_SLAB_SIZE;
+
+	for (; obj + obj_size <= end; obj += obj_size) {
+		PoolObject *free_obj = (PoolObject *)obj;
+		free_obj->next = free_lists[cls];
+		free_lists[cls] = free_obj;
+	}
+}
+
+
+/*
+-> Returns a zero-initialized block of at least 'size' bytes (behaves like calloc())
+-> Small blocks are recycled through per size class free lists instead of hitting malloc()
+-> Blocks larger than POOL_MAX_SIZE fall back to calloc()
+*/
+void *pool_alloc(size_t size) {
+	if (size > POOL_MAX_SIZE) {
+		void *block = calloc(1, size);
+		if (block == NULL)
+			halt("pool_alloc");
+
+		return block;
+	}
+
+	int cls = size_class(size);
+	if (free_lists[cls] == NULL)
+		grow_class(cls);
+
+	PoolObject *obj = free_lists[cls];
+	free_lists[cls] = obj->next;
+
+	memset(obj, 0, size);
+	return obj;
+}
+
+
+/*
+-> Returns a block obtained from pool_alloc() back to the pool
+-> 'size' must be the same size that was passed to pool_alloc()
+*/
+void pool_free(void *ptr, size_t size) {
+	if (ptr == NULL)
+		return;
+
+	if (size > POOL_MAX_SIZE) {
+		free(ptr);
+		return;
+	}
+
+	int cls = size_class(size);
+	PoolObject *obj = ptr;
+	obj->next = free_lists[cls];
+	free_lists[cls] = obj;
+}
+
+
+/*
+-> Releases every slab back to the system
+-> All blocks handed out by the pool become invalid after this call
+*/
+void pool_destroy(void) {
+	while (slabs != NULL) {
+		PoolSlab *next = slabs->next;
+		free(slabs);
+		slabs = next;
+	}
+
+	for (int cls = 0; cls < POOL_CLASSES; cls++)
+		free_lists[cls] = NULL;
+}
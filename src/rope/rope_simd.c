@@ -0,0 +1,261 @@
+#include "rope.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ROPE_X86 1
+#include <immintrin.h>
+#endif
+
+
+/*
+-> Newline kernels used for building leaf metadata and for locating lines
+-> Each kernel has a scalar version and (on x86) SSE2/AVX2 versions
+-> The best version supported by the CPU is picked at runtime on first use
+*/
+
+
+// Returns the number of '\n's in the first 'len' bytes of 'str' (one byte at a time)
+static int count_newlines_scalar(const char *str, int len) {
+	int count = 0;
+	for (int i = 0; i < len; i++)
+		if (str[i] == '\n')
+			count++;
+
+	return count;
+}
+
+
+// Returns the index of the 'n'th (0-based) '\n' in the first 'len' bytes of 'str' or -1 (one byte at a time)
+static int find_nth_newline_scalar(const char *str, int len, int n) {
+	for (int i = 0; i < len; i++) {
+		if (str[i] == '\n') {
+			if (n == 0)
+				return i;
+			n--;
+		}
+	}
+
+	return -1;
+}
+
+
+// Stores the offsets of the '\n's in the first 'len' bytes of 'str' in 'offsets' and returns their count (one byte at a time)
+static int list_newlines_scalar(const char *str, int len, unsigned short *offsets) {
+	int count = 0;
+	for (int i = 0; i < len; i++)
+		if (str[i] == '\n')
+			offsets[count++] = i;
+
+	return count;
+}
+
+
+#ifdef ROPE_X86
+
+// Returns the position of the 'n'th (0-based) set bit of 'mask' (the caller guarantees that it exists)
+static int nth_set_bit(unsigned int mask, int n) {
+	while (n--)
+		mask &= mask - 1;  // clear the lowest set bit
+
+	return __builtin_ctz(mask);
+}
+
+
+// Stores 'base' + the position of every set bit of 'mask' in 'offsets' (lowest first) and returns how many were stored
+static int list_set_bits(unsigned int mask, int base, unsigned short *offsets) {
+	int count = 0;
+	for (; mask != 0; mask &= mask - 1)
+		offsets[count++] = base + __builtin_ctz(mask);
+
+	return count;
+}
+
+
+// SSE2 version of count_newlines_scalar() (16 bytes per step)
+__attribute__((target("sse2,popcnt")))
+static int count_newlines_sse2(const char *str, int len) {
+	const __m128i newline = _mm_set1_epi8('\n');
+	int count = 0;
+	int i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)(str + i));
+		count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+	}
+
+	return count + count_newlines_scalar(str + i, len - i);
+}
+
+
+// SSE2 version of find_nth_newline_scalar() (16 bytes per step)
+__attribute__((target("sse2,popcnt")))
+static int find_nth_newline_sse2(const char *str, int len, int n) {
+	const __m128i newline = _mm_set1_epi8('\n');
+	int i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)(str + i));
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+		int count = __builtin_popcount(mask);
+
+		if (n < count)
+			return i + nth_set_bit(mask, n);
+		n -= count;
+	}
+
+	int pos = find_nth_newline_scalar(str + i, len - i, n);
+	return (pos == -1) ? -1 : i + pos;
+}
+
+
+// SSE2 version of list_newlines_scalar() (16 bytes per step)
+__attribute__((target("sse2")))
+static int list_newlines_sse2(const char *str, int len, unsigned short *offsets) {
+	const __m128i newline = _mm_set1_epi8('\n');
+	int count = 0;
+	int i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)(str + i));
+		count += list_set_bits(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)), i, offsets + count);
+	}
+
+	int tail = list_newlines_scalar(str + i, len - i, offsets + count);
+	for (int k = count; k < count + tail; k++)
+		offsets[k] += i;
+
+	return count + tail;
+}
+
+
+// AVX2 version of count_newlines_scalar() (32 bytes per step)
+__attribute__((target("avx2,popcnt")))
+static int count_newlines_avx2(const char *str, int len) {
+	const __m256i newline = _mm256_set1_epi8('\n');
+	int count = 0;
+	int i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i *)(str + i));
+		count += __builtin_popcount((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)));
+	}
+
+	return count + count_newlines_sse2(str + i, len - i);
+}
+
+
+// AVX2 version of find_nth_newline_scalar() (32 bytes per step)
+__attribute__((target("avx2,popcnt")))
+static int find_nth_newline_avx2(const char *str, int len, int n) {
+	const __m256i newline = _mm256_set1_epi8('\n');
+	int i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i *)(str + i));
+		unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline));
+		int count = __builtin_popcount(mask);
+
+		if (n < count)
+			return i + nth_set_bit(mask, n);
+		n -= count;
+	}
+
+	int pos = find_nth_newline_sse2(str + i, len - i, n);
+	return (pos == -1) ? -1 : i + pos;
+}
+
+
+// AVX2 version of list_newlines_scalar() (32 bytes per step)
+__attribute__((target("avx2")))
+static int list_newlines_avx2(const char *str, int len, unsigned short *offsets) {
+	const __m256i newline = _mm256_set1_epi8('\n');
+	int count = 0;
+	int i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i *)(str + i));
+		count += list_set_bits((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)), i, offsets + count);
+	}
+
+	int tail = list_newlines_sse2(str + i, len - i, offsets + count);
+	for (int k = count; k < count + tail; k++)
+		offsets[k] += i;
+
+	return count + tail;
+}
+
+#endif
+
+
+// Kernels in use (resolved by pick_kernels() on first use)
+static int (*count_kernel)(const char *str, int len) = NULL;
+static int (*find_kernel)(const char *str, int len, int n) = NULL;
+static int (*list_kernel)(const char *str, int len, unsigned short *offsets) = NULL;
+
+
+// Picks the fastest kernels supported by the CPU
+static void pick_kernels(void) {
+	count_kernel = count_newlines_scalar;
+	find_kernel = find_nth_newline_scalar;
+	list_kernel = list_newlines_scalar;
+
+#ifdef ROPE_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+		count_kernel = count_newlines_avx2;
+		find_kernel = find_nth_newline_avx2;
+		list_kernel = list_newlines_avx2;
+	}
+	else if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) {
+		count_kernel = count_newlines_sse2;
+		find_kernel = find_nth_newline_sse2;
+		list_kernel = list_newlines_sse2;
+	}
+#endif
+}
+
+
+/*
+-> Returns the number '\n's in the first 'len' bytes of a string
+-> Returns zero if NULL string is passed
+*/
+int count_newlines(const char *str, int len) {
+	if (str == NULL || len <= 0)
+		return 0;
+
+	if (count_kernel == NULL)
+		pick_kernels();
+
+	return count_kernel(str, len);
+}
+
+
+/*
+-> Returns the index of the 'n'th (0-based) '\n' in the first 'len' bytes of a string
+-> Returns -1 if there are not enough '\n's (or if NULL string is passed)
+*/
+int find_nth_newline(const char *str, int len, int n) {
+	if (str == NULL || len <= 0 || n < 0)
+		return -1;
+
+	if (find_kernel == NULL)
+		pick_kernels();
+
+	return find_kernel(str, len, n);
+}
+
+
+/*
+-> Stores the offsets of the '\n's in the first 'len' bytes of a string in 'offsets' (in increasing order)
+-> 'offsets' must have room for every '\n' (see count_newlines()) and 'len' must not exceed 65536 (offsets are 16 bits)
+-> Returns the number of offsets stored
+*/
+int list_newlines(const char *str, int len, unsigned short *offsets) {
+	if (str == NULL || len <= 0)
+		return 0;
+
+	if (list_kernel == NULL)
+		pick_kernels();
+
+	return list_kernel(str, len, offsets);
+}
@@ -1,41 +1,58 @@
 #include "rope.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "terminal.h"
 
 
 /*
 -> Returns the index (0-based) of a given newline (identified by 0-based newline_idx) from a rope
+-> 'offset' is added to the result (rope index of the first character of 'node')
 -> Returns -1 if newline_idx is out of range
 */
 int find_newline_pos(RopeNode *node, int newline_idx, int offset) {
-    if (node == NULL)
+    RopeIter it;
+    int rank;
+    if (!rope_iter_init_newline(&it, node, newline_idx, &rank))
         return -1;
 
-    // BASE CASE
-    if (is_leaf(node)) {
-        int newline_count = 0;
-        for (int i = 0; node->str[i] != '\0'; i++) {
-            if (node->str[i] == '\n') {
-                if (newline_count == newline_idx)
-                    return offset + i;  // offset = index of the first character of the text chunk
-                newline_count++;
-            }
-        }
+    return offset + rope_iter_pos(&it);
+}
+
 
+/*
+-> Returns the index of the last newline before index 'idx' of a rope (-1 if there is none)
+-> Walks backwards from 'idx' one leaf at a time through a RopeIter (no descent from the root per leaf)
+-> Only the leaves' newline offset tables are read -> no text is rescanned
+*/
+int find_prev_newline(RopeNode *root, int idx) {
+    RopeIter it;
+    if (root == NULL || idx <= 0 || !rope_iter_init(&it, root, MIN(idx, root->total_len)))
         return -1;
-    }
 
-    int left_newlines = node->left ? node->left->newlines : 0;
+    int limit = it.offset;  // newlines of the current leaf at offsets below this one lie before 'idx'
+    while (true) {
+        const unsigned short *offsets = get_line_offsets(it.leaf);
+
+        // Binary search for the number of newlines below 'limit'
+        int low = 0;
+        int high = node_newlines(it.leaf);
+        while (low < high) {
+            int mid = (low + high) / 2;
+            if (offsets[mid] < limit)
+                low = mid + 1;
+            else
+                high = mid;
+        }
 
-    // CASE-1: target newline is in the left subtree
-    if (newline_idx < left_newlines)
-        return find_newline_pos(node->left, newline_idx, offset);
+        if (low > 0)
+            return it.leaf_start + offsets[low - 1];
 
-    // CASE-2: target newline is in the right subtree
-    else
-        return find_newline_pos(node->right, newline_idx - left_newlines, offset + node->weight);  // adjust newline_idx and offset
+        if (!rope_iter_prev_leaf(&it))
+            return -1;
+        limit = it.offset;  // end of the previous leaf
+    }
 }
 
 
@@ -71,24 +88,86 @@ int get_line_start(RopeNode *root, int line) {
 -> Returns zero in case of error
 */
 int get_line_length(RopeNode *root, int line) {
-    if (root == NULL)
+    int len;
+    if (get_line_spans(root, line, 1, NULL, &len) == 0)
         return 0;
 
-    int start = get_line_start(root, line);
-    if (start >= root->total_len)
+    return len;
+}
+
+
+/*
+-> Moves an iterator positioned right before a newline (see rope_iter_init_newline()) to the next newline of the rope
+-> 'rank' is the rank of the newline within the iterator's leaf
+-> Returns the leaf holding the next newline (NULL if there is none)
+*/
+static RopeNode *next_newline(RopeIter *it, int *rank) {
+    (*rank)++;
+
+    while (*rank >= node_newlines(it->leaf)) {
+        if (!rope_iter_next_leaf(it))
+            return NULL;
+        *rank = 0;
+    }
+
+    return it->leaf;
+}
+
+
+/*
+-> Finds the spans of 'count' consecutive lines starting at line 'first' (0-based) with a single descent of the rope
+-> Stores the starting index of each line in 'starts' and its length (excluding newline) in 'lengths' (either may be NULL)
+-> The following lines are found by walking the leaves' newline offset tables -> no text is rescanned
+-> Only the newlines up to the last line stored are needed -> the rest of the rope doesn't have to be counted
+-> Returns the number of lines stored (lines past the end of the rope are not stored)
+*/
+int get_line_spans(RopeNode *root, int first, int count, int *starts, int *lengths) {
+    if (first < 0 || count <= 0)
         return 0;
 
-    int end;
-    if (line >= root->newlines)  // last line
-        end = root->total_len;
-    else
-        end = find_newline_pos(root, line, 0);
+    int total_len = root ? root->total_len : 0;
+
+    // Walk the newlines from the one ending the line before 'first' (or from the first newline of the rope)
+    RopeIter it;
+    int rank;
+    RopeNode *leaf = NULL;
+    if (rope_iter_init_newline(&it, root, (first == 0) ? 0 : first - 1, &rank))
+        leaf = it.leaf;
+    else if (first > 0)
+        return 0;  // line 'first' doesn't exist
+
+    int line_start = 0;
+    if (first > 0) {
+        line_start = it.leaf_start + get_line_offsets(leaf)[rank] + 1;
+        leaf = next_newline(&it, &rank);
+    }
+
+    int stored = 0;
+    while (stored < count) {
+        // Line ends at the next newline (or at the end of the rope for the last line)
+        int line_end = leaf ? it.leaf_start + get_line_offsets(leaf)[rank] : total_len;
+
+        if (starts)
+            starts[stored] = line_start;
+        if (lengths)
+            lengths[stored] = line_end - line_start;
+        stored++;
+
+        if (leaf == NULL)
+            break;  // last line of the rope
 
-    return end - start;
+        line_start = line_end + 1;
+        leaf = next_newline(&it, &rank);
+    }
+
+    return stored;
 }
 
 
-// Returns the total number of lines in a rope
+/*
+-> Returns the total number of lines in a rope
+-> Counts the newlines of the parts which haven't been counted yet (the whole text of a freshly mapped file, see node_newlines())
+*/
 int count_total_lines(RopeNode *root) {
     if (root == NULL || root->total_len == 0)
         return 1;  // treat empty buffers as one empty line
@@ -96,6 +175,21 @@ int count_total_lines(RopeNode *root) {
     // Ex: "Hello" -> 0 newlines -> 1 line
     // Ex: "Hello\nThere" -> 1 newline -> 2 lines
     // Ex: "Hello\n" -> 1 newline -> 2 lines (last line is an empty line)
+    return node_newlines(root) + 1;
+}
+
+
+/*
+-> Returns the total number of lines in a rope if it is known without counting anything (O(1))
+-> Returns -1 while parts of the rope haven't been counted yet (see count_total_lines())
+*/
+int known_total_lines(RopeNode *root) {
+    if (root == NULL || root->total_len == 0)
+        return 1;
+
+    if (root->newlines == NEWLINES_UNKNOWN)
+        return -1;
+
     return root->newlines + 1;
 }
 
@@ -116,28 +210,26 @@ char *get_line_segment_from_rope(RopeNode *root, int line, int start, int maxlen
 
     int len = MIN(maxlen, line_len - start);
     int lstart = get_line_start(root, line) + start;
-    int offset;
 
-    RopeNode *leaf = leaf_at(root, lstart, &offset);
-    if (!leaf && len != 0)
+    RopeIter it;
+    if (!rope_iter_init(&it, root, lstart))
         halt("get_line_segment_from_rope");
 
     char *result = calloc(len + 1, 1);
     if (!result)
         halt("get_line_segment_from_rope");
 
-    // Walk through the leaves to fetch segment
-    for (int idx = 0; idx < len; idx++) {
-        if (offset >= leaf->weight) {
-            leaf = next_leaf(leaf);
-            if (!leaf)
-                halt("get_line_segment_from_rope");
-
-            offset = 0;
-        }
-
-        result[idx] = leaf->str[offset];
-        offset++;
+    // Walk through the leaves to fetch segment (one contiguous copy per span)
+    int idx = 0;
+    while (idx < len) {
+        const char *span;
+        int n = rope_iter_next(&it, &span);
+        if (n == 0)
+            halt("get_line_segment_from_rope");
+
+        n = MIN(len - idx, n);
+        memcpy(result + idx, span, n);
+        idx += n;
     }
 
     return result;
@@ -150,69 +242,22 @@ char *get_line_segment_from_rope(RopeNode *root, int line, int start, int maxlen
 -> Returns NULL if the index is out of range
 */
 RopeNode *leaf_at(RopeNode *node, int idx, int *offset) {
-    if (node == NULL)
-        return NULL;
-
-    // BASE CASE
-    if (is_leaf(node)) {
-        if (idx < 0 || idx >= node->weight)
-            return NULL;
-
-        *offset = idx;
-        return node;
-    }
-
-    // CASE-1: character lies in the left subtree
-    if (idx < node->weight)
-        return leaf_at(node->left, idx, offset);
-
-    // CASE-2: character lies in the right subtree
-    else
-        return leaf_at(node->right, idx - node->weight, offset);  // adjust index
-}
-
-
-/*
--> Returns the next leaf in inorder traversal given a leaf node in a rope
--> Returns NULL if no next leaf exists
-*/
-RopeNode *next_leaf(RopeNode *leaf) {
-    if (!leaf || !is_leaf(leaf))
-        return NULL;
-
-    RopeNode *next = successor_node(leaf);
-    while (next != NULL && !is_leaf(next))
-        next = successor_node(next);
-
-    return next;
-}
-
-
-/*
--> Returns the inorder successor of a node in a rope
--> Returns NULL if successor doesn't exist
-*/
-RopeNode *successor_node(RopeNode *node) {
-    if (!node)
-        return NULL;
-
-    // CASE-A: 'node' has a right child -> successor is the leftmost node in the right subtree
-    if (node->right) {
-        node = node->right;
-        while (node->left != NULL)
+    while (node != NULL && !is_leaf(node)) {
+        // CASE-1: character lies in the left subtree
+        if (idx < node->weight) {
             node = node->left;
+        }
 
-        return node;
+        // CASE-2: character lies in the right subtree
+        else {
+            idx -= node->weight;  // adjust index
+            node = node->right;
+        }
     }
 
-    // CASE-B: 'node' has no right child -> walk up the rope until you came from a left child
-    else {
-        RopeNode *parent = node->parent;
-        while (parent != NULL && parent->left != node) {
-            node = parent;
-            parent = node->parent;
-        }
+    if (node == NULL || idx < 0 || idx >= node->weight)
+        return NULL;
 
-        return parent;
-    }
+    *offset = idx;
+    return node;
 }
@@ -1,8 +1,12 @@
 #ifndef TERMINAL_H
 #define TERMINAL_H
 
+#include <stdbool.h>
 #include <termios.h>
 
+#define KEY_BATCH_SIZE 64             // max number of keys decoded per read_keys() call
+#define CURSOR_REPLY_TIMEOUT_MS 100   // time to wait for the terminal's reply to a cursor position query
+
 
 // Special values for some keys
 enum SpecialKeys {
@@ -17,23 +21,57 @@ enum SpecialKeys {
     END_KEY,
     PAGE_UP,
     PAGE_DOWN,
+    PASTE_KEY,  // a bracketed paste was received (text is in 'paste')
 };
 
+// Events reported by wait_event()
+typedef enum EventType {
+    EVENT_NONE,    // woke up without anything to handle
+    EVENT_INPUT,   // keys are ready to be read
+    EVENT_RESIZE,  // terminal window was resized (SIGWINCH)
+    EVENT_TIMER,   // timer armed by arm_timer() expired
+    EVENT_NOTIFY,  // another thread called notify_event()
+} EventType;
+
+// Text received through bracketed paste mode ("<esc>[200~" ... "<esc>[201~")
+typedef struct PasteBuffer {
+    char *text;    // pasted text (newlines normalized to '\n', not null terminated)
+    int len;       // length of the pasted text
+    int capacity;  // capacity of 'text'
+} PasteBuffer;
+
 
 // State of terminal before enabling raw mode
 extern struct termios old_term;
 
+// Most recent bracketed paste (valid until the next PASTE_KEY)
+extern PasteBuffer paste;
+
 
 // Core operations
 void enable_raw(void);
 void disable_raw(void);
-int read_key(void);
 int get_cursor_pos(int *row, int *col);
 int get_window_size(int *rows, int *cols);
 
+// Event loop operations
+void init_events(void);
+void close_events(void);
+void arm_timer(int ms);
+void notify_event(void);
+int wait_event(void);
+
+// Input operations
+bool input_pending(void);
+bool read_byte(char *ch, int timeout_ms);
+int read_key(void);
+int read_keys(int *keys, int max);
+int escape_parser(void);
+int read_paste(void);
+
 // Helper functions
 void halt(const char *str);
-int escape_parser(void);
+void write_all(int fd, const char *buf, int len);
 
 
 #endif
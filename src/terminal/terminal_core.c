@@ -1,6 +1,5 @@
 #include "terminal.h"
 
-#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
@@ -42,43 +41,30 @@ void enable_raw(void) {
 
     // a) set minimum number of bytes of input needed before read() can return
     // b) set maximum amount of time (in tenths of a second) to wait for read() to return
+    // NOTE: read() never blocks -> the input layer waits with poll() and then reads whatever is available (see terminal_input.c)
     raw_term.c_cc[VMIN] = 0;
-    raw_term.c_cc[VTIME] = 1;  // basically adds a timeout for read()
+    raw_term.c_cc[VTIME] = 0;
 
     // Load modified terminal state
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw_term) == -1) {
         halt("tcsetattr");
     }
+
+    // Enable bracketed paste mode -> pasted text arrives wrapped in "<esc>[200~" and "<esc>[201~"
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
 
 // Switches terminal from raw mode to canonical mode by restoring the initial terminal state (which was in canonical mode)
 void disable_raw(void) {
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);  // disable bracketed paste mode
+
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &old_term) == -1) {
         halt("tcsetattr");
     }
 }
 
 
-// Captures keypress from STDIN and returns key/sequence code
-int read_key(void) {
-    int nread;
-    char ch;
-
-    // NOTE: read() has a timeout of 10 ms in raw mode
-    // Loop ends when exactly one character is read from STDIN
-    while ((nread = read(STDIN_FILENO, &ch, 1)) != 1) {
-        if (nread == -1 && errno != EAGAIN)
-            halt("read");
-    }
-
-    if (ch == '\x1b')  // NOTE: escape sequence start with '\x1b' (ESC)
-        return escape_parser();
-
-    return ch;
-}
-
-
 /*
 -> Retrieves the current cursor position
 -> Stores the row and column in 'row' and 'col'
@@ -96,7 +82,7 @@ int get_cursor_pos(int *row, int *col) {
 
     // Read the terminal's response into 'buffer'
     while (i < sizeof(buffer) - 1) {
-        if (read(STDIN_FILENO, &buffer[i], 1) != 1)
+        if (!read_byte(&buffer[i], CURSOR_REPLY_TIMEOUT_MS))
             return -1;
         if (buffer[i] == 'R')
             break;
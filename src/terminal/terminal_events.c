@@ -0,0 +1,137 @@
+#include "terminal.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+
+/*
+-> Every source of events the editor reacts to is a file descriptor -> the editor sleeps in a single poll() until one is ready
+-> SIGWINCH is received through a signalfd (no signal handler) and timeouts through a timerfd
+-> Background threads (e.g. a save) wake the editor up through an eventfd
+-> Nothing wakes the editor up while it is idle
+*/
+static int signal_fd = -1;  // delivers SIGWINCH
+static int timer_fd = -1;   // fires once when the timer armed by arm_timer() expires
+static int notify_fd = -1;  // signalled by notify_event()
+
+
+// Creates the signalfd, the timerfd and the eventfd used by wait_event()
+void init_events(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGWINCH);
+
+    // Blocked signals stay pending until they are read from the signalfd
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+        halt("sigprocmask");
+
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1)
+        halt("signalfd");
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1)
+        halt("timerfd_create");
+
+    notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notify_fd == -1)
+        halt("eventfd");
+}
+
+
+// Closes the file descriptors created by init_events()
+void close_events(void) {
+    if (signal_fd != -1)
+        close(signal_fd);
+    if (timer_fd != -1)
+        close(timer_fd);
+    if (notify_fd != -1)
+        close(notify_fd);
+
+    signal_fd = -1;
+    timer_fd = -1;
+    notify_fd = -1;
+}
+
+
+/*
+-> Arms the timer to fire once after 'ms' milliseconds (replaces a previously armed timer)
+-> Passing 0 disarms the timer
+*/
+void arm_timer(int ms) {
+    if (timer_fd == -1)
+        return;
+
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = ms / 1000;
+    spec.it_value.tv_nsec = (long)(ms % 1000) * 1000000;
+
+    if (timerfd_settime(timer_fd, 0, &spec, NULL) == -1)
+        halt("timerfd_settime");
+}
+
+
+/*
+-> Makes wait_event() report EVENT_NOTIFY
+-> Safe to call from any thread (several calls before the event is handled are reported once)
+*/
+void notify_event(void) {
+    uint64_t one = 1;
+    write(notify_fd, &one, sizeof(one));
+}
+
+
+/*
+-> Blocks until something happens and returns what it was (see EventType)
+-> Buffered input which hasn't been decoded yet is reported right away
+-> When several sources are ready, input comes first
+*/
+int wait_event(void) {
+    if (input_pending())
+        return EVENT_INPUT;
+
+    struct pollfd fds[4] = {
+        {STDIN_FILENO, POLLIN, 0},
+        {signal_fd, POLLIN, 0},
+        {timer_fd, POLLIN, 0},
+        {notify_fd, POLLIN, 0},
+    };
+
+    while (poll(fds, 4, -1) == -1) {
+        if (errno != EINTR)
+            halt("poll");
+    }
+
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+        return EVENT_INPUT;
+
+    if (fds[1].revents & POLLIN) {
+        struct signalfd_siginfo info;
+        while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+            ;  // drain -> several resizes in a row are handled once
+
+        return EVENT_RESIZE;
+    }
+
+    if (fds[2].revents & POLLIN) {
+        uint64_t expirations;
+        read(timer_fd, &expirations, sizeof(expirations));
+
+        return EVENT_TIMER;
+    }
+
+    if (fds[3].revents & POLLIN) {
+        uint64_t count;
+        read(notify_fd, &count, sizeof(count));  // resets the counter
+
+        return EVENT_NOTIFY;
+    }
+
+    return EVENT_NONE;
+}
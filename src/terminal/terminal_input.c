@@ -0,0 +1,300 @@
+#include "terminal.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define INPUT_BUFFER_SIZE 4096  // capacity of the input ring buffer (power of 2)
+#define ESC_TIMEOUT_MS 50       // time to wait for the rest of an escape sequence before treating '\x1b' as the Escape key
+
+
+/*
+-> Ring buffer holding bytes read from STDIN which haven't been decoded into keys yet
+-> Bytes are read in as large chunks as the terminal provides -> one read() per burst of input instead of one per byte
+-> 'head' and 'tail' only ever grow (they are wrapped with a mask when indexing)
+*/
+typedef struct InputBuffer {
+    char data[INPUT_BUFFER_SIZE];
+    unsigned int head;  // position of the next byte to decode
+    unsigned int tail;  // position where the next byte read from STDIN is stored
+} InputBuffer;
+
+
+static InputBuffer input = {{0}, 0, 0};
+
+
+// Returns the number of buffered bytes
+static int input_len(void) {
+    return input.tail - input.head;
+}
+
+
+// Returns the 'i'th buffered byte (the caller guarantees that it exists)
+static char peek_input(int i) {
+    return input.data[(input.head + i) & (INPUT_BUFFER_SIZE - 1)];
+}
+
+
+// Discards the first 'n' buffered bytes
+static void consume_input(int n) {
+    input.head += n;
+}
+
+
+/*
+-> Waits up to 'timeout_ms' milliseconds (-1 = forever) for STDIN to become readable and reads everything available into the ring buffer
+-> Returns the number of bytes read (0 on timeout or if the buffer is full)
+*/
+static int fill_input(int timeout_ms) {
+    int space = INPUT_BUFFER_SIZE - input_len();
+    if (space == 0)
+        return 0;
+
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready == -1) {
+        if (errno == EINTR)
+            return 0;
+        halt("poll");
+    }
+    if (ready == 0)
+        return 0;
+
+    // Read into the contiguous free space after 'tail' (the rest is picked up by the next fill)
+    unsigned int pos = input.tail & (INPUT_BUFFER_SIZE - 1);
+    int contiguous = INPUT_BUFFER_SIZE - pos;
+    if (contiguous > space)
+        contiguous = space;
+
+    int nread = read(STDIN_FILENO, &input.data[pos], contiguous);
+    if (nread == -1) {
+        if (errno == EAGAIN || errno == EINTR)
+            return 0;
+        halt("read");
+    }
+
+    input.tail += nread;
+    return nread;
+}
+
+
+/*
+-> Makes sure that at least 'n' bytes are buffered
+-> Waits at most ESC_TIMEOUT_MS for each chunk of missing input
+-> Returns 'false' if the input didn't arrive in time
+*/
+static bool wait_input(int n) {
+    while (input_len() < n) {
+        if (fill_input(ESC_TIMEOUT_MS) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+
+// Returns 'true' if there is buffered input which hasn't been decoded yet
+bool input_pending(void) {
+    return input_len() > 0;
+}
+
+
+/*
+-> Reads one byte from STDIN (through the ring buffer) into 'ch'
+-> Waits up to 'timeout_ms' milliseconds (-1 = forever)
+-> Returns 'true' on success and 'false' on timeout
+*/
+bool read_byte(char *ch, int timeout_ms) {
+    if (input_len() == 0 && fill_input(timeout_ms) == 0)
+        return false;
+
+    *ch = peek_input(0);
+    consume_input(1);
+    return true;
+}
+
+
+/*
+-> Decodes the next key from the ring buffer (blocks until there is input)
+-> Returns key/sequence code
+*/
+int read_key(void) {
+    while (input_len() == 0)
+        fill_input(-1);
+
+    char ch = peek_input(0);
+    consume_input(1);
+
+    if (ch == '\x1b')  // NOTE: escape sequence start with '\x1b' (ESC)
+        return escape_parser();
+
+    return ch;
+}
+
+
+/*
+-> Decodes every key which is already buffered (at least one, blocks until there is input)
+-> Stores up to 'max' key codes in 'keys' and returns how many were stored
+-> A batch ends right after a PASTE_KEY ('paste' only holds one paste at a time)
+-> A batch also ends before a trailing '\x1b' -> the Escape key timeout is only waited for when the key is decoded alone
+*/
+int read_keys(int *keys, int max) {
+    int count = 0;
+
+    keys[count++] = read_key();
+
+    while (count < max && keys[count - 1] != PASTE_KEY) {
+        if (input_len() == 0)
+            fill_input(0);  // pick up input which arrived while decoding (doesn't wait)
+        if (input_len() == 0 || (input_len() < 3 && peek_input(0) == '\x1b'))
+            break;
+
+        keys[count++] = read_key();
+    }
+
+    return count;
+}
+
+
+/*
+-> Parses escape sequences from the ring buffer and returns the key code
+-> Assumes that the '\x1b' is already consumed
+-> Returns an escape character in case of failure (the bytes examined are consumed)
+*/
+int escape_parser(void) {
+    char seq[3];
+
+    if (!wait_input(1))  // 2nd character
+        return '\x1b';
+    seq[0] = peek_input(0);
+    consume_input(1);
+    if (!wait_input(1))  // 3rd character
+        return '\x1b';
+    seq[1] = peek_input(0);
+    consume_input(1);
+
+    if (seq[0] == '[') {
+        // Escape sequence is 4 characters long
+        if (seq[1] >= '0' && seq[1] <= '9') {
+            if (!wait_input(1))  // 4th character
+                return '\x1b';
+            seq[2] = peek_input(0);
+            consume_input(1);
+
+            // Escape sequence is 6 characters long: start of a bracketed paste -> <esc>[200~
+            if (seq[1] == '2' && seq[2] == '0') {
+                if (!wait_input(2))
+                    return '\x1b';
+
+                bool is_paste = (peek_input(0) == '0' && peek_input(1) == '~');
+                consume_input(2);
+
+                return is_paste ? read_paste() : '\x1b';
+            }
+
+            if (seq[2] == '~') {
+                switch (seq[1]) {
+                    case '1':
+                        return HOME_KEY;   // <esc>[1~
+                    case '2':
+                        return INS_KEY;    // <esc>[2~
+                    case '3':
+                        return DEL_KEY;    // <esc>[3~
+                    case '4':
+                        return END_KEY;    // <esc>[4~
+                    case '5':
+                        return PAGE_UP;    // <esc>[5~
+                    case '6':
+                        return PAGE_DOWN;  // <esc>[6~
+                    case '7':
+                        return HOME_KEY;   // <esc>[7~
+                    case '8':
+                        return END_KEY;    // <esc>[8~
+                }
+            }
+        }
+
+        // Escape sequence is 3 characters long
+        else {
+            switch (seq[1]) {
+                case 'A':
+                    return ARROW_UP;     // <esc>[A
+                case 'B':
+                    return ARROW_DOWN;   // <esc>[B
+                case 'C':
+                    return ARROW_RIGHT;  // <esc>[C
+                case 'D':
+                    return ARROW_LEFT;   // <esc>[D
+                case 'H':
+                    return HOME_KEY;     // <esc>[H
+                case 'F':
+                    return END_KEY;      // <esc>[F
+            }
+        }
+    }
+
+    else if (seq[0] == 'O') {
+        switch (seq[1]) {
+            case 'H':
+                return HOME_KEY;  // <esc>OH
+            case 'F':
+                return END_KEY;   // <esc>OF
+        }
+    }
+
+    return '\x1b';  // invalid escape sequence
+}
+
+
+/*
+-> Reads the body of a bracketed paste (the "<esc>[200~" marker is already consumed) into 'paste'
+-> Stops after the closing "<esc>[201~" marker, which isn't stored
+-> Terminals send newlines as '\r' in pastes -> "\r\n" and '\r' are stored as '\n'
+-> Returns PASTE_KEY
+*/
+int read_paste(void) {
+    static const char end_marker[] = "\x1b[201~";
+    const int marker_len = sizeof(end_marker) - 1;
+
+    paste.len = 0;
+
+    while (paste.len < marker_len || memcmp(paste.text + paste.len - marker_len, end_marker, marker_len) != 0) {
+        while (input_len() == 0)
+            fill_input(-1);
+
+        if (paste.len == paste.capacity) {
+            int cap = (paste.capacity == 0) ? 4096 : paste.capacity * 2;
+            char *new = realloc(paste.text, cap);
+            if (new == NULL)
+                halt("read_paste");
+
+            paste.text = new;
+            paste.capacity = cap;
+        }
+
+        paste.text[paste.len++] = peek_input(0);
+        consume_input(1);
+    }
+
+    paste.len -= marker_len;
+
+    // Normalize newlines
+    int len = 0;
+    for (int i = 0; i < paste.len; i++) {
+        if (paste.text[i] == '\r') {
+            paste.text[len++] = '\n';
+            if (i + 1 < paste.len && paste.text[i + 1] == '\n')
+                i++;
+        }
+        else {
+            paste.text[len++] = paste.text[i];
+        }
+    }
+    paste.len = len;
+
+    return PASTE_KEY;
+}